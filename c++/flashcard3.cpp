@@ -8,417 +8,6622 @@
 #include <cstdlib>
 #include <ctime>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <random>
+#include <array>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <dirent.h>
 
 using namespace std;
 
 const int MAX_BOX = 5;
 
-class FlashCard {
-public:
-    string front;
-    string back;
+// Building with -DCOUNT_ALLOCATIONS replaces global new/delete with versions
+// that count heap allocations, which --bench-alloc reports.
+#ifdef COUNT_ALLOCATIONS
+#include <new>
 
-    FlashCard(string f = "", string b = "") : front(f), back(b) {}
-};
+atomic<size_t> allocationCount{0};
 
-class CardRecord {
-private:
-    FlashCard card;
-    int box = 0;
-    int dueRound = 0;
-    int timesReviewed = 0;
-    int timesCorrect = 0;
+// Every form below allocates with malloc or aligned_alloc and frees with
+// free, so any new may be paired with any delete.
+void* countedAlloc(size_t size, size_t alignment = 0) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (size == 0) size = 1;
+    if (alignment == 0) return malloc(size);
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
 
-public:
-    FlashCard getCard() const { return card; }
-    void setCard(FlashCard c) { card = c; }
+// Kept out of line: once a delete is inlined, GCC sees free() called on a
+// pointer from operator new and warns (-Wmismatched-new-delete).
+[[gnu::noinline]] void countedFree(void* p) noexcept { free(p); }
+
+void* operator new(size_t size) {
+    if (void* p = countedAlloc(size)) return p;
+    throw bad_alloc();
+}
 
-    int getBox() const { return box; }
-    void setBox(int b) { box = b; }
+void* operator new[](size_t size) { return operator new(size); }
 
-    int getDueRound() const { return dueRound; }
-    void setDueRound(int r) { dueRound = r; }
+void* operator new(size_t size, align_val_t alignment) {
+    if (void* p = countedAlloc(size, size_t(alignment))) return p;
+    throw bad_alloc();
+}
 
-    int getTimesReviewed() const { return timesReviewed; }
-    void setTimesReviewed(int t) { timesReviewed = t; }
+void* operator new[](size_t size, align_val_t alignment) {
+    return operator new(size, alignment);
+}
 
-    int getTimesCorrect() const { return timesCorrect; }
-    void setTimesCorrect(int t) { timesCorrect = t; }
+void* operator new(size_t size, const nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return countedAlloc(size); }
 
-    double getAccuracy() const {
-        return timesReviewed > 0 ? (timesCorrect * 100.0 / timesReviewed) : 0;
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAlloc(size, size_t(alignment));
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAlloc(size, size_t(alignment));
+}
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { countedFree(p); }
+#endif
+
+// Hot-path instrumentation. METRIC_TIMER(id) times the rest of the enclosing
+// scope and METRIC_BYTES(id, n) adds to its byte count; building with
+// -DDISABLE_METRICS compiles both out. Every thread records into its own
+// histograms, written only by that thread, so recording takes no lock and
+// no atomic read-modify-write; dumpMetrics merges them.
+enum MetricId {
+    METRIC_LOAD,
+    METRIC_SAVE,
+    METRIC_DUE_CARDS,
+    METRIC_CHECK_ANSWER,
+    METRIC_GRADE,
+    METRIC_COUNT
+};
+
+const char* const METRIC_NAMES[METRIC_COUNT] = {
+    "load", "save", "getDueCards", "checkAnswer", "grade"
+};
+
+#ifndef DISABLE_METRICS
+// Log-linear latency buckets: exact below 4 ns, then four per power of two.
+const int METRIC_BUCKETS = 256;
+
+struct MetricHistogram {
+    atomic<uint64_t> buckets[METRIC_BUCKETS] = {};
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> totalNs{0};
+    atomic<uint64_t> maxNs{0};
+    atomic<uint64_t> bytes{0};
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < 4) return ns;
+        int msb = 63 - __builtin_clzll(ns);
+        return 4 * (msb - 1) + ((ns >> (msb - 2)) & 3);
     }
 
-    string getProgressBar() const {
-        const int width = 20;
-        int filled = (timesReviewed > 0) ?
-                    (width * timesCorrect / timesReviewed) : 0;
-        string bar(filled, '=');
-        bar += string(width - filled, '-');
-        return "[" + bar + "]";
+    static uint64_t bucketStart(int bucket) {
+        if (bucket < 4) return bucket;
+        return uint64_t(4 + bucket % 4) << (bucket / 4 - 1);
     }
 
-    void markCorrect(int currentRound) {
-        timesCorrect++;
-        timesReviewed++;
-        if (box < MAX_BOX) box++;
-        dueRound = currentRound + (box >= 2 ? (1 << (box - 1)) : 1);
+    // Only the owning thread writes, so plain load/store pairs suffice.
+    static void bump(atomic<uint64_t>& value, uint64_t by) {
+        value.store(value.load(memory_order_relaxed) + by, memory_order_relaxed);
     }
 
-    void markIncorrect(int currentRound) {
-        timesReviewed++;
-        box = 0;
-        dueRound = currentRound + 1;
+    void record(uint64_t ns) {
+        bump(buckets[bucketOf(ns)], 1);
+        bump(count, 1);
+        bump(totalNs, ns);
+        if (ns > maxNs.load(memory_order_relaxed)) maxNs.store(ns, memory_order_relaxed);
+    }
+
+    // Adds other's counts to this histogram, whose writers must be excluded.
+    void merge(const MetricHistogram& other) {
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            bump(buckets[b], other.buckets[b].load(memory_order_relaxed));
+        }
+        bump(count, other.count.load(memory_order_relaxed));
+        bump(totalNs, other.totalNs.load(memory_order_relaxed));
+        uint64_t otherMax = other.maxNs.load(memory_order_relaxed);
+        if (otherMax > maxNs.load(memory_order_relaxed)) {
+            maxNs.store(otherMax, memory_order_relaxed);
+        }
+        bump(bytes, other.bytes.load(memory_order_relaxed));
     }
 };
 
-class Deck {
+struct ThreadMetrics {
+    MetricHistogram histograms[METRIC_COUNT];
+};
+
+class MetricsRegistry {
 private:
-    vector<CardRecord> cards;
-    int currentRound = 0;
+    mutex lock;
+    vector<unique_ptr<ThreadMetrics>> threads;
+    // Totals of the threads that have exited, written under lock, so a
+    // server starting a thread per client keeps one entry per live thread.
+    ThreadMetrics retired;
 
-    string trim(const string& str) {
-        size_t first = str.find_first_not_of(" \t");
-        if (first == string::npos) return "";
-        size_t last = str.find_last_not_of(" \t");
-        return str.substr(first, (last-first+1));
+    // Registers a thread's histograms on its first use and retires them when
+    // the thread exits.
+    struct ThreadSlot {
+        ThreadMetrics* metrics = instance().addThread();
+        ~ThreadSlot() { instance().retireThread(metrics); }
+    };
+
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
     }
 
-    string normalizeString(const string& str) {
-        string result;
-        for (char c : str) {
-            if (isalnum(c)) {
-                result += tolower(c);
+    static MetricHistogram& local(MetricId id) {
+        thread_local ThreadSlot slot;
+        return slot.metrics->histograms[id];
+    }
+
+    ThreadMetrics* addThread() {
+        lock_guard<mutex> guard(lock);
+        threads.push_back(make_unique<ThreadMetrics>());
+        return threads.back().get();
+    }
+
+    void retireThread(ThreadMetrics* metrics) {
+        lock_guard<mutex> guard(lock);
+        for (int id = 0; id < METRIC_COUNT; id++) {
+            retired.histograms[id].merge(metrics->histograms[id]);
+        }
+        auto it = find_if(threads.begin(), threads.end(),
+                          [metrics](const unique_ptr<ThreadMetrics>& t) {
+                              return t.get() == metrics;
+                          });
+        *it = move(threads.back());
+        threads.pop_back();
+    }
+
+    void dump(ostream& out) {
+        lock_guard<mutex> guard(lock);
+        out << "\n=== METRICS ===\n"
+            << left << setw(13) << "operation" << right << setw(10) << "calls"
+            << setw(12) << "mean us" << setw(12) << "p50 us" << setw(12) << "p99 us"
+            << setw(12) << "max us" << setw(14) << "bytes" << "\n";
+        for (int id = 0; id < METRIC_COUNT; id++) {
+            uint64_t buckets[METRIC_BUCKETS] = {};
+            uint64_t count = 0, totalNs = 0, maxNs = 0, bytes = 0;
+            vector<const ThreadMetrics*> all = {&retired};
+            for (const auto& thread : threads) all.push_back(thread.get());
+            for (const ThreadMetrics* thread : all) {
+                const MetricHistogram& h = thread->histograms[id];
+                for (int b = 0; b < METRIC_BUCKETS; b++) {
+                    buckets[b] += h.buckets[b].load(memory_order_relaxed);
+                }
+                count += h.count.load(memory_order_relaxed);
+                totalNs += h.totalNs.load(memory_order_relaxed);
+                maxNs = max(maxNs, h.maxNs.load(memory_order_relaxed));
+                bytes += h.bytes.load(memory_order_relaxed);
             }
+            auto percentile = [&](double q) {
+                uint64_t rank = uint64_t(q * count), seen = 0;
+                for (int b = 0; b < METRIC_BUCKETS; b++) {
+                    seen += buckets[b];
+                    if (seen > rank) return MetricHistogram::bucketStart(b) / 1000.0;
+                }
+                return maxNs / 1000.0;
+            };
+            out << left << setw(13) << METRIC_NAMES[id] << right << setw(10) << count
+                << fixed << setprecision(2)
+                << setw(12) << (count ? totalNs / 1000.0 / count : 0.0)
+                << setw(12) << (count ? percentile(0.50) : 0.0)
+                << setw(12) << (count ? percentile(0.99) : 0.0)
+                << setw(12) << maxNs / 1000.0 << setw(14) << bytes << "\n";
         }
-        return result;
     }
+};
+
+class ScopedTimer {
+private:
+    MetricId id;
+    chrono::steady_clock::time_point start;
 
 public:
-    void addCard(const FlashCard& card) {
-        if (!card.front.empty() && !card.back.empty()) {
-            CardRecord cr;
-            cr.setCard(card);
-            cards.push_back(cr);
-            cout << "Card added successfully!\n";
-        }
+    explicit ScopedTimer(MetricId id) : id(id), start(chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        MetricsRegistry::local(id).record(ns);
     }
+};
 
-    vector<CardRecord>& getCards() { return cards; }
-    size_t getCardCount() const { return cards.size(); }
+#define METRIC_CONCAT_(a, b) a##b
+#define METRIC_CONCAT(a, b) METRIC_CONCAT_(a, b)
+#define METRIC_TIMER(id) ScopedTimer METRIC_CONCAT(metricTimer, __LINE__)(id)
+#define METRIC_BYTES(id, n) MetricHistogram::bump(MetricsRegistry::local(id).bytes, (n))
 
-    void nextRound() { currentRound++; }
-    int getCurrentRound() const { return currentRound; }
+void dumpMetrics(ostream& out) { MetricsRegistry::instance().dump(out); }
+#else
+#define METRIC_TIMER(id) ((void)0)
+#define METRIC_BYTES(id, n) ((void)0)
 
-    void reset() {
-        cards.clear();
-        currentRound = 0;
-    }
+void dumpMetrics(ostream& out) { out << "Metrics were compiled out (DISABLE_METRICS)\n"; }
+#endif
 
-    vector<CardRecord*> getDueCards() {
-        vector<CardRecord*> due;
-        for (auto& cr : cards) {
-            if (cr.getDueRound() <= currentRound) {
-                due.push_back(&cr);
-            }
-        }
+// Binary deck layout (native byte order):
+//   BinaryDeckHeader | BinaryCardEntry[cardCount] | text blob (textSize bytes)
+// Each entry points at its front text in the blob; the back follows directly.
+const char DECK_MAGIC[4] = {'F', 'C', 'D', 'K'};
+const uint32_t DECK_VERSION = 1;
 
-        // Fisher-Yates shuffle
-        for (size_t i = due.size() - 1; i > 0; i--) {
-            size_t j = rand() % (i + 1);
-            swap(due[i], due[j]);
-        }
+struct BinaryDeckHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t currentRound;
+    uint32_t reserved;
+    uint64_t cardCount;
+    uint64_t textSize;
+};
 
-        return due;
-    }
+struct BinaryCardEntry {
+    int32_t box;
+    int32_t dueRound;
+    int32_t timesReviewed;
+    int32_t timesCorrect;
+    uint64_t textOffset;
+    uint32_t frontLength;
+    uint32_t backLength;
+};
 
-    bool checkAnswer(const string& userAnswer, const string& correctAnswer) {
-        string normalizedUser = normalizeString(userAnswer);
-        string normalizedCorrect = normalizeString(correctAnswer);
-        return normalizedUser == normalizedCorrect;
-    }
+// Compressed deck layout (.fcz, native byte order):
+//   CompressedDeckHeader | int32 boxes[cardCount] | int32 dueRounds[cardCount]
+//   | int32 reviewed[cardCount] | int32 correct[cardCount] | text chunks
+// The text chunks are front-coded as described at TextChunk and are used in
+// place from the mapped file.
+const char COMPRESSED_DECK_MAGIC[4] = {'F', 'C', 'D', 'Z'};
+const uint32_t COMPRESSED_DECK_VERSION = 1;
 
-    bool save(const string& filename) {
-        ofstream file(filename);
-        if (!file) {
-            cerr << "Error saving to " << filename << "\n";
-            return false;
-        }
+struct CompressedDeckHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t currentRound;
+    uint32_t chunkCount;
+    uint64_t cardCount;
+};
 
-        file << currentRound << "\n";
-        for (const auto& cr : cards) {
-            file << cr.getCard().front << "|" << cr.getCard().back << "|"
-                 << cr.getBox() << "|" << cr.getDueRound() << "|"
-                 << cr.getTimesReviewed() << "|" << cr.getTimesCorrect() << "\n";
-        }
-        cout << "Saved " << cards.size() << " cards to " << filename << "\n";
-        return true;
-    }
+// Wall-clock due times layout, kept next to a deck as "<deck>.times":
+//   DueTimesHeader | int32 dueMinutes[cardCount]
+// fingerprint is the deck's fingerprint when the file was written, so the
+// times are only used with the deck file saved alongside them.
+const char DUE_TIMES_MAGIC[4] = {'F', 'C', 'D', 'T'};
+const uint32_t DUE_TIMES_VERSION = 1;
 
-    bool load(const string& filename) {
-        ifstream file(filename);
-        if (!file) {
-            cerr << "No save file found, starting fresh\n";
-            return false;
-        }
+struct DueTimesHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t cardCount;
+    uint64_t fingerprint;
+};
 
-        cards.clear();
-        string line;
+// Learner progress layout, one file per learner of a shared deck:
+//   ProgressFileHeader | int32 boxes[cardCount] | int32 dueRounds[cardCount]
+//   | int32 reviewed[cardCount] | int32 correct[cardCount]
+// contentHash covers the text of the first cardCount cards, so progress is
+// never applied to different cards.
+const char PROGRESS_MAGIC[4] = {'F', 'C', 'L', 'P'};
+const uint32_t PROGRESS_VERSION = 1;
 
-        // First line is current round
-        getline(file, line);
-        try {
-            currentRound = stoi(line);
-        } catch (...) {
-            currentRound = 0;
-        }
+struct ProgressFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t currentRound;
+    uint32_t reserved;
+    uint64_t cardCount;
+    uint64_t contentHash;
+};
 
-        while (getline(file, line)) {
-            line = trim(line);
-            if (line.empty()) continue;
+bool hasSuffix(const string& str, const string& suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
 
-            vector<string> parts;
-            stringstream ss(line);
-            string part;
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
 
-            while (getline(ss, part, '|')) {
-                parts.push_back(part);
-            }
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
 
-            if (parts.size() != 6) continue;
+    bool open(const string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
 
-            try {
-                CardRecord cr;
-                cr.setCard(FlashCard(parts[0], parts[1]));
-                cr.setBox(stoi(parts[2]));
-                cr.setDueRound(stoi(parts[3]));
-                cr.setTimesReviewed(stoi(parts[4]));
-                cr.setTimesCorrect(stoi(parts[5]));
-                cards.push_back(cr);
-            } catch (...) {
-                cerr << "Error parsing card data\n";
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        length = st.st_size;
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                return false;
             }
+            data = static_cast<const char*>(p);
         }
-        cout << "Loaded " << cards.size() << " cards\n";
+        ::close(fd);
         return true;
     }
+
+    void close() {
+        if (data) munmap(const_cast<char*>(data), length);
+        data = nullptr;
+        length = 0;
+    }
+
+    const char* begin() const { return data; }
+    size_t size() const { return length; }
 };
 
-class SessionManager {
+// Reads a file through an LRU cache of PAGE_SIZE pages holding at most
+// capacity bytes, shared by every thread. A missing page is read with pread
+// outside the lock, so threads hitting the cache never wait for another
+// thread's I/O, and its buffer is swapped with the evicted page's, so a full
+// cache reads without allocating.
+class PageCache {
+public:
+    static constexpr size_t PAGE_SIZE = 64 << 10;
+
 private:
-    void clearInput() {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    static constexpr uint32_t NONE = UINT32_MAX;
+    struct Page {
+        uint64_t number = 0;
+        unique_ptr<char[]> bytes;
+        uint32_t newer = NONE;
+        uint32_t older = NONE;
+    };
+
+    int fd = -1;
+    uint64_t fileLength = 0;
+    size_t maxPages = 1;
+    mutable mutex lock;
+    mutable vector<Page> pages;
+    mutable unordered_map<uint64_t, uint32_t> slots;
+    mutable uint32_t newest = NONE;
+    mutable uint32_t oldest = NONE;
+    mutable uint64_t hits = 0;
+    mutable uint64_t misses = 0;
+
+    void unlink(uint32_t slot) const {
+        Page& page = pages[slot];
+        (page.newer == NONE ? newest : pages[page.newer].older) = page.older;
+        (page.older == NONE ? oldest : pages[page.older].newer) = page.newer;
     }
 
-public:
-    void runSession(Deck& deck) {
-        deck.nextRound();
-        auto& allCards = deck.getCards();
+    void pushNewest(uint32_t slot) const {
+        pages[slot].newer = NONE;
+        pages[slot].older = newest;
+        (newest == NONE ? oldest : pages[newest].newer) = slot;
+        newest = slot;
+    }
 
-        if (allCards.empty()) {
-            cout << "\nNo cards available for review!\n";
-            return;
+    // Copies n bytes at start of page number into out, if out is set.
+    bool readPage(uint64_t number, size_t start, size_t n, char* out) const {
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = slots.find(number);
+            if (it != slots.end()) {
+                hits++;
+                unlink(it->second);
+                pushNewest(it->second);
+                if (out) memcpy(out, pages[it->second].bytes.get() + start, n);
+                return true;
+            }
+            misses++;
         }
 
-        cout << "\n=== REVIEW SESSION ===\n";
-        cout << "Press Enter to reveal answer, then enter 'c' for correct or 'i' for incorrect\n";
-        cout << "Enter 'q' to quit\n\n";
-
-        // Shuffle cards
-        for (size_t i = allCards.size() - 1; i > 0; i--) {
-            size_t j = rand() % (i + 1);
-            swap(allCards[i], allCards[j]);
+        thread_local unique_ptr<char[]> buffer;
+        if (!buffer) buffer.reset(new char[PAGE_SIZE]);
+        size_t length = min<uint64_t>(PAGE_SIZE, fileLength - number * PAGE_SIZE);
+        for (size_t got = 0; got < length;) {
+            ssize_t r = pread(fd, buffer.get() + got, length - got,
+                              number * PAGE_SIZE + got);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            got += r;
         }
+        if (out) memcpy(out, buffer.get() + start, n);
 
-        for (auto& cr : allCards) {
-            cout << "Q: " << cr.getCard().front << "\n";
-            cout << "Press Enter to show answer...";
-            string input;
-            getline(cin, input);
+        lock_guard<mutex> guard(lock);
+        if (slots.count(number)) return true;
+        uint32_t slot;
+        if (pages.size() < maxPages) {
+            slot = pages.size();
+            pages.emplace_back();
+        } else {
+            slot = oldest;
+            unlink(slot);
+            slots.erase(pages[slot].number);
+        }
+        pages[slot].number = number;
+        swap(pages[slot].bytes, buffer);
+        slots[number] = slot;
+        pushNewest(slot);
+        return true;
+    }
 
-            if (input == "q") {
-                break;
-            }
+public:
+    PageCache() = default;
+    PageCache(const PageCache&) = delete;
+    PageCache& operator=(const PageCache&) = delete;
+    ~PageCache() {
+        if (fd >= 0) ::close(fd);
+    }
 
-            cout << "\nA: " << cr.getCard().back << "\n\n";
+    bool open(const string& filename, size_t capacity) {
+        fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) return false;
+        fileLength = st.st_size;
+        maxPages = max<size_t>(1, capacity / PAGE_SIZE);
+        return true;
+    }
 
-            while (true) {
-                cout << "Was your answer correct? (c/i): ";
-                getline(cin, input);
+    uint64_t size() const { return fileLength; }
 
-                if (input == "c") {
-                    cr.markCorrect(deck.getCurrentRound());
-                    cout << " Marked as correct! (Box " << cr.getBox() << ")\n\n";
-                    break;
-                } else if (input == "i") {
-                    cr.markIncorrect(deck.getCurrentRound());
-                    cout << " Marked as incorrect (Box 0)\n\n";
-                    break;
-                } else if (input == "q") {
-                    return;
-                } else {
-                    cout << "Invalid input. Please enter 'c' or 'i'.\n";
-                }
-            }
+    // Copies [offset, offset + length) of the file into out, or only pulls
+    // it into the cache when out is null. The range must lie in the file.
+    bool read(uint64_t offset, size_t length, char* out) const {
+        while (length > 0) {
+            size_t start = offset % PAGE_SIZE;
+            size_t n = min(length, PAGE_SIZE - start);
+            if (!readPage(offset / PAGE_SIZE, start, n, out)) return false;
+            offset += n;
+            length -= n;
+            if (out) out += n;
         }
-        cout << "\nSession complete!\n";
+        return true;
     }
-};
 
-class FlashCardApp {
-private:
-    Deck deck;
-    SessionManager sessionManager;
-    const string filename = "spaced_cards.txt";
+    size_t capacityBytes() const { return maxPages * PAGE_SIZE; }
 
-    void clearInput() {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    size_t residentBytes() const {
+        lock_guard<mutex> guard(lock);
+        return pages.size() * PAGE_SIZE;
     }
 
-    void resetData() {
-        cout << "\n=== RESET ALL DATA ===\n";
-        cout << "This will delete ALL cards and reset all progress!\n";
-        cout << "Are you sure? (yes/no): ";
+    pair<uint64_t, uint64_t> hitsAndMisses() const {
+        lock_guard<mutex> guard(lock);
+        return {hits, misses};
+    }
+};
 
-        string confirmation;
-        getline(cin, confirmation);
+const size_t DEFAULT_TEXT_CACHE_MB = 64;
 
-        if (confirmation == "yes") {
-            deck.reset();
-            remove(filename.c_str());
-            cout << "All data has been reset.\n";
-        } else {
-            cout << "Reset cancelled.\n";
+// Collects output in one large reusable buffer and hands it to a file
+// descriptor in big writes. Numbers are formatted with to_chars straight into
+// the buffer, so streaming a report allocates nothing per line.
+class BufferedWriter {
+private:
+    int fd;
+    vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+
+    char* room(size_t n) {
+        if (buffer.size() - used < n) flush();
+        return buffer.data() + used;
+    }
+
+    // Writes all of data, retrying writes interrupted by a signal.
+    void writeAll(const char* data, size_t size) {
+        for (size_t done = 0; done < size && !failed;) {
+            ssize_t n = ::write(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) failed = true;
+            else done += n;
         }
     }
 
-    void createCard() {
-        string front, back;
-        cout << "\nEnter front (question): ";
-        getline(cin, front);
-        cout << "Enter back (answer): ";
-        getline(cin, back);
+public:
+    explicit BufferedWriter(int fd, size_t capacity = 1 << 20)
+        : fd(fd), buffer(capacity) {}
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+    ~BufferedWriter() { flush(); }
 
-        deck.addCard(FlashCard(front, back));
+    bool flush() {
+        writeAll(buffer.data(), used);
+        used = 0;
+        return !failed;
     }
 
-    void showStatistics() {
-        if (deck.getCardCount() == 0) {
-            cout << "\nNo cards available!\n";
-            return;
-        }
-
-        cout << "\n=== PERFORMANCE STATISTICS ===\n";
+    bool good() const { return !failed; }
 
-        int totalReviews = 0;
-        int totalCorrect = 0;
-        map<int, int> boxCounts;
-        for (int i = 0; i <= MAX_BOX; i++) boxCounts[i] = 0;
+    void put(char c) {
+        *room(1) = c;
+        used++;
+    }
 
-        for (const auto& cr : deck.getCards()) {
-            totalReviews += cr.getTimesReviewed();
-            totalCorrect += cr.getTimesCorrect();
-            boxCounts[cr.getBox()]++;
+    void write(string_view text) {
+        if (text.size() > buffer.size()) {
+            flush();
+            writeAll(text.data(), text.size());
+            return;
         }
+        memcpy(room(text.size()), text.data(), text.size());
+        used += text.size();
+    }
 
-        double overallAccuracy = totalReviews > 0 ?
-            (totalCorrect * 100.0 / totalReviews) : 0;
+    void writeInt(long long value) {
+        char* p = room(24);
+        used = to_chars(p, p + 24, value).ptr - buffer.data();
+    }
 
-        cout << "\nOverall:\n";
-        cout << "Total reviews: " << totalReviews << "\n";
-        cout << "Correct answers: " << totalCorrect << "\n";
-        cout << "Accuracy: " << fixed << setprecision(1)
-             << overallAccuracy << "%\n";
+    void writeFixed(double value, int precision) {
+        char* p = room(64);
+        auto result = to_chars(p, p + 64, value, chars_format::fixed, precision);
+        if (result.ec == errc()) used = result.ptr - buffer.data();
+    }
 
-        cout << "\nCard Details:\n";
-        for (size_t i = 0; i < deck.getCards().size(); i++) {
-            const auto& cr = deck.getCards()[i];
-            cout << "\nCard #" << (i+1) << " (Box " << cr.getBox() << ")\n";
-            cout << "Q: " << cr.getCard().front << "\n";
-            cout << cr.getProgressBar() << "  "
-                 << fixed << setprecision(1) << cr.getAccuracy() << "%\n";
-            cout << "Reviews: " << cr.getTimesReviewed()
-                 << " | Correct: " << cr.getTimesCorrect() << "\n";
+    void writeRepeated(char c, size_t count) {
+        while (count > 0 && !failed) {
+            size_t n = min(count, buffer.size());
+            memset(room(n), c, n);
+            used += n;
+            count -= n;
         }
     }
 
-    void showHeatmap() {
-        if (deck.getCardCount() == 0) {
-            cout << "\nNo cards available!\n";
+    // RFC 4180: quote fields containing separators, quotes or line breaks.
+    void writeCsvField(string_view text) {
+        if (text.find_first_of(",\"\r\n") == string_view::npos) {
+            write(text);
             return;
         }
-
-        map<int, int> boxCounts;
-        for (int i = 0; i <= MAX_BOX; i++) {
-            boxCounts[i] = 0;
+        put('"');
+        for (size_t pos = 0;;) {
+            size_t quote = text.find('"', pos);
+            write(text.substr(pos, quote - pos));
+            if (quote == string_view::npos) break;
+            write("\"\"");
+            pos = quote + 1;
         }
+        put('"');
+    }
 
-        for (const auto& cr : deck.getCards()) {
-            boxCounts[cr.getBox()]++;
+    void writeJsonString(string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        put('"');
+        size_t start = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = text[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            write(text.substr(start, i - start));
+            start = i + 1;
+            switch (c) {
+                case '"': write("\\\""); break;
+                case '\\': write("\\\\"); break;
+                case '\n': write("\\n"); break;
+                case '\t': write("\\t"); break;
+                case '\r': write("\\r"); break;
+                default: {
+                    char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    write(string_view(escaped, sizeof(escaped)));
+                }
+            }
         }
+        write(text.substr(start));
+        put('"');
+    }
+};
 
-        cout << "\n=== DIFFICULTY HEATMAP ===\n";
-        cout << "Box 0: Easiest, Box " << MAX_BOX << ": Hardest\n\n";
+// Reads CSV or TSV records from a file descriptor in large chunks. Fields
+// may be wrapped in double quotes, inside which delimiters and line breaks
+// are literal and "" stands for one quote (RFC 4180). Carriage returns
+// outside quotes are dropped, so CRLF files read like LF files.
+class DelimitedReader {
+private:
+    int fd;
+    char delimiter;
+    vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+    bool finished = false;
 
-        const int max_bar_length = 50;
-        int max_count = 0;
-        for (const auto& [box, count] : boxCounts) {
-            if (count > max_count) max_count = count;
+    bool fill() {
+        if (pos < end) return true;
+        if (finished) return false;
+        pos = end = 0;
+        ssize_t n;
+        do {
+            n = ::read(fd, buffer.data(), buffer.size());
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            finished = true;
+            return false;
         }
+        end = n;
+        return true;
+    }
 
-        for (int i = 0; i <= MAX_BOX; i++) {
-            int bar_length = max_count > 0 ?
-                (boxCounts[i] * max_bar_length / max_count) : 0;
-            cout << "[" << i << "] " << string(bar_length, '#')
-                 << " " << boxCounts[i] << " cards\n";
-        }
+    static string& nextField(vector<string>& fields, size_t& count) {
+        if (count == fields.size()) fields.emplace_back();
+        fields[count].clear();
+        return fields[count++];
     }
 
 public:
-    FlashCardApp() {
-        srand(time(0));
-        deck.load(filename);
+    DelimitedReader(int fd, char delimiter, size_t capacity = 1 << 20)
+        : fd(fd), delimiter(delimiter), buffer(capacity) {}
+
+    // Guesses how many records a file of fileBytes holds from the line
+    // length in the first chunk.
+    size_t estimateRecords(size_t fileBytes) {
+        if (!fill()) return 0;
+        size_t lines = count(buffer.data() + pos, buffer.data() + end, '\n');
+        return lines == 0 ? 1 : fileBytes / ((end - pos) / lines + 1) + 1;
     }
 
-    ~FlashCardApp() {
-        deck.save(filename);
+    // Reads the next record into the first count entries of fields, reusing
+    // their capacity. Returns false once the input is exhausted.
+    bool next(vector<string>& fields, size_t& count) {
+        count = 0;
+        if (!fill()) return false;
+        string* field = &nextField(fields, count);
+        bool quoted = false;
+        while (fill()) {
+            const char* data = buffer.data();
+            if (quoted) {
+                const char* quote = static_cast<const char*>(
+                    memchr(data + pos, '"', end - pos));
+                size_t run = (quote ? quote - data : end) - pos;
+                field->append(data + pos, run);
+                pos += run;
+                if (!quote) continue;
+                pos++;
+                if (fill() && buffer[pos] == '"') {
+                    field->push_back('"');
+                    pos++;
+                } else {
+                    quoted = false;
+                }
+                continue;
+            }
+            char c = data[pos++];
+            if (c == delimiter) {
+                field = &nextField(fields, count);
+            } else if (c == '\n') {
+                break;
+            } else if (c == '"' && field->empty()) {
+                quoted = true;
+            } else if (c != '\r') {
+                size_t start = pos - 1;
+                while (pos < end && data[pos] != delimiter && data[pos] != '\n' &&
+                       data[pos] != '\r' && data[pos] != '"') {
+                    pos++;
+                }
+                field->append(data + start, pos - start);
+            }
+        }
+        return true;
     }
+};
 
-    void run() {
-        while (true) {
-            cout << "\n===== FLASHCARDS =====\n";
-            cout << "Total Cards: " << deck.getCardCount();
-            cout << "\n\n1. Create Card\n";
-            cout << "2. Review Session\n";
-            cout << "3. Show Statistics\n";
-            cout << "4. Show Heatmap\n";
+class FlashCard {
+public:
+    string front;
+    string back;
+
+    FlashCard(string f = "", string b = "") : front(move(f)), back(move(b)) {}
+};
+
+// Parses like stoi: skips leading whitespace, accepts a sign and ignores
+// anything after the digits. Works on views so no string is built.
+bool parseInt(string_view field, int& value) {
+    size_t i = 0;
+    while (i < field.size() && isspace(static_cast<unsigned char>(field[i]))) i++;
+    if (i + 1 < field.size() && field[i] == '+' &&
+        isdigit(static_cast<unsigned char>(field[i + 1]))) {
+        i++;
+    }
+    auto result = from_chars(field.data() + i, field.data() + field.size(), value);
+    return result.ec == errc();
+}
+
+// Parses a whole command-line argument as a count. Unlike stoul it rejects
+// signs, trailing text and overflow instead of throwing or wrapping.
+bool parseCount(const string& arg, size_t& value) {
+    auto result = from_chars(arg.data(), arg.data() + arg.size(), value);
+    return !arg.empty() && result.ec == errc() && result.ptr == arg.data() + arg.size();
+}
+
+string_view trimView(string_view str) {
+    size_t first = str.find_first_not_of(" \t");
+    if (first == string_view::npos) return string_view();
+    size_t last = str.find_last_not_of(" \t");
+    return str.substr(first, last - first + 1);
+}
+
+// The text deck format separates fields with '|', so card text is written
+// with '|', '\\' and line breaks escaped by a backslash.
+const char* deckEscape(char c) {
+    switch (c) {
+        case '|': return "\\|";
+        case '\\': return "\\\\";
+        case '\n': return "\\n";
+        case '\r': return "\\r";
+        default: return nullptr;
+    }
+}
+
+// Passes text to append in runs, with escapes in place of special bytes.
+template <typename Append>
+void escapeDeckText(string_view text, Append append) {
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (const char* escape = deckEscape(text[i])) {
+            append(text.substr(run, i - run));
+            append(string_view(escape));
+            run = i + 1;
+        }
+    }
+    append(text.substr(run));
+}
+
+// Reverses escapeDeckText into out. A backslash before any other byte is
+// kept, so files written before escaping keep their backslashes.
+void unescapeDeckText(string_view text, string& out) {
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < text.size()) {
+            switch (text[i + 1]) {
+                case '|': c = '|'; i++; break;
+                case '\\': i++; break;
+                case 'n': c = '\n'; i++; break;
+                case 'r': c = '\r'; i++; break;
+            }
+        }
+        out += c;
+    }
+}
+
+// Front-coded card text. Cards are grouped in blocks of TEXT_BLOCK_CARDS;
+// within a block each front is stored as the length of the prefix it shares
+// with the previous card's front plus the remaining bytes, and each back the
+// same way against the previous back, with lengths as LEB128 varints. A chunk
+// is a run of blocks laid out as
+//   uint64 cardCount | uint64 blockCount | uint64 blockOffsets[blockCount + 1]
+//   | block bytes
+// and is used unchanged both in memory and inside .fcz deck files.
+const size_t TEXT_BLOCK_CARDS = 16;
+
+class TextChunk {
+private:
+    shared_ptr<const void> owner;
+    const char* data = nullptr;
+    size_t length = 0;
+    uint64_t id = 0;
+    size_t cards = 0;
+    size_t blocks = 0;
+
+    static uint64_t nextId() {
+        static atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    static void putVarint(vector<char>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    static uint64_t getVarint(const char*& p, const char* end) {
+        uint64_t value = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t byte = *p++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        return value;
+    }
+
+    static size_t sharedPrefix(string_view a, string_view b) {
+        size_t n = min(a.size(), b.size()), i = 0;
+        while (i < n && a[i] == b[i]) i++;
+        return i;
+    }
+
+    uint64_t word(size_t i) const {
+        uint64_t value;
+        memcpy(&value, data + i * sizeof(uint64_t), sizeof(value));
+        return value;
+    }
+
+public:
+    // Encodes count cards, where text(i) returns card i's front and back.
+    template <typename TextFn>
+    static shared_ptr<const TextChunk> encode(size_t count, TextFn text) {
+        size_t blockCount = (count + TEXT_BLOCK_CARDS - 1) / TEXT_BLOCK_CARDS;
+        auto bytes = make_shared<vector<char>>((blockCount + 3) * sizeof(uint64_t));
+        vector<uint64_t> offsets;
+        string previousFront, previousBack;
+        for (size_t i = 0; i < count; i++) {
+            if (i % TEXT_BLOCK_CARDS == 0) {
+                offsets.push_back(bytes->size());
+                previousFront.clear();
+                previousBack.clear();
+            }
+            auto [front, back] = text(i);
+            for (auto [part, previous] : {make_pair(front, &previousFront),
+                                          make_pair(back, &previousBack)}) {
+                size_t prefix = sharedPrefix(part, *previous);
+                putVarint(*bytes, prefix);
+                putVarint(*bytes, part.size() - prefix);
+                bytes->insert(bytes->end(), part.begin() + prefix, part.end());
+                previous->assign(part);
+            }
+        }
+        offsets.push_back(bytes->size());
+
+        uint64_t header[2] = {count, blockCount};
+        memcpy(bytes->data(), header, sizeof(header));
+        memcpy(bytes->data() + sizeof(header), offsets.data(),
+               offsets.size() * sizeof(uint64_t));
+        auto chunk = make_shared<TextChunk>();
+        chunk->data = bytes->data();
+        chunk->length = bytes->size();
+        chunk->owner = move(bytes);
+        chunk->id = nextId();
+        chunk->cards = count;
+        chunk->blocks = blockCount;
+        return chunk;
+    }
+
+    // Uses an encoded chunk at the start of [data, data + available) in
+    // place, keeping owner alive for as long as the chunk. Returns null if
+    // the bytes are not a well-formed chunk.
+    static shared_ptr<const TextChunk> adopt(const char* data, size_t available,
+                                             shared_ptr<const void> owner) {
+        auto chunk = make_shared<TextChunk>();
+        chunk->data = data;
+        if (available < 3 * sizeof(uint64_t)) return nullptr;
+        chunk->cards = chunk->word(0);
+        chunk->blocks = chunk->word(1);
+        if (chunk->blocks != (chunk->cards + TEXT_BLOCK_CARDS - 1) / TEXT_BLOCK_CARDS ||
+            chunk->blocks > available / sizeof(uint64_t) - 3) {
+            return nullptr;
+        }
+        uint64_t previous = (chunk->blocks + 3) * sizeof(uint64_t);
+        for (size_t b = 0; b <= chunk->blocks; b++) {
+            uint64_t offset = chunk->word(2 + b);
+            if (offset < previous || offset > available) return nullptr;
+            previous = offset;
+        }
+        chunk->length = previous;
+        chunk->owner = move(owner);
+        chunk->id = nextId();
+        return chunk;
+    }
+
+    uint64_t getId() const { return id; }
+    size_t cardCount() const { return cards; }
+    size_t byteSize() const { return length; }
+    const char* bytes() const { return data; }
+
+    // Decodes one block into text, with bounds[2k] and bounds[2k + 1] the
+    // start of card k's front and back and bounds[2k + 2] the end of it.
+    void decodeBlock(size_t block, string& text, vector<uint32_t>& bounds) const {
+        bounds.clear();
+        const char* p = data + word(2 + block);
+        const char* end = data + word(3 + block);
+        size_t used = 0;
+        size_t previous[2] = {0, 0};
+        size_t previousLength[2] = {0, 0};
+        while (p < end) {
+            for (int part = 0; part < 2; part++) {
+                size_t prefix = min<size_t>(getVarint(p, end), previousLength[part]);
+                size_t rest = min<size_t>(getVarint(p, end), end - p);
+                if (text.size() < used + prefix + rest) {
+                    text.resize(max(2 * text.size(), used + prefix + rest));
+                }
+                bounds.push_back(used);
+                memcpy(&text[used], &text[previous[part]], prefix);
+                memcpy(&text[used + prefix], p, rest);
+                p += rest;
+                previous[part] = used;
+                previousLength[part] = prefix + rest;
+                used += prefix + rest;
+            }
+        }
+        bounds.push_back(used);
+    }
+};
+
+// Card text left in a binary deck file and read through a PageCache when a
+// card is needed. Nothing per card is kept in memory: the card's entry is
+// paged in along with its text.
+class PagedDeckText {
+private:
+    PageCache cache;
+    uint64_t id;
+    uint64_t tableOffset = sizeof(BinaryDeckHeader);
+    uint64_t textOffset = 0;
+    uint64_t textSize = 0;
+    size_t cards = 0;
+
+    bool entry(size_t card, BinaryCardEntry& e) const {
+        return cache.read(tableOffset + card * sizeof(e), sizeof(e),
+                          reinterpret_cast<char*>(&e));
+    }
+
+public:
+    PagedDeckText() {
+        static atomic<uint64_t> counter{0};
+        id = ++counter;
+    }
+
+    // Opens a binary deck whose header has already been checked against the
+    // file size; entries are checked as they are read.
+    bool open(const string& filename, const BinaryDeckHeader& header, size_t cacheBytes) {
+        if (!cache.open(filename, cacheBytes)) return false;
+        cards = header.cardCount;
+        textOffset = tableOffset + cards * sizeof(BinaryCardEntry);
+        textSize = header.textSize;
+        return true;
+    }
+
+    uint64_t getId() const { return id; }
+    size_t cardCount() const { return cards; }
+    const PageCache& getCache() const { return cache; }
+
+    // Reads card's front and back, back to back, into text and returns the
+    // front's length, or -1 if the entry is damaged or unreadable.
+    long long read(size_t card, string& text) const {
+        BinaryCardEntry e;
+        if (!entry(card, e)) return -1;
+        uint64_t length = uint64_t(e.frontLength) + e.backLength;
+        if (e.textOffset > textSize || textSize - e.textOffset < length) return -1;
+        text.resize(length);
+        if (!cache.read(textOffset + e.textOffset, length, &text[0])) return -1;
+        return e.frontLength;
+    }
+
+    // Pulls card's entry and text into the cache without copying them out.
+    void prefetch(size_t card) const {
+        BinaryCardEntry e;
+        if (!entry(card, e)) return;
+        uint64_t length = uint64_t(e.frontLength) + e.backLength;
+        if (e.textOffset > textSize || textSize - e.textOffset < length) return;
+        cache.read(textOffset + e.textOffset, length, nullptr);
+    }
+};
+
+// Card text for a deck, in up to three runs. The first compressedCards cards
+// may live in front-coded chunks (after compress() or when loaded from a .fcz
+// file) and the next pagedCards in a binary deck file read on demand. The
+// rest are plain: each card's front and back are packed back to back in large
+// blocks, or point straight into a mapped binary deck, so loading and adding
+// cards does not allocate per card. Views of plain cards stay valid until
+// clear(); a view of a compressed or paged card points into a per-thread
+// cache and stays valid until that thread has decoded DECODED_BLOCKS more
+// blocks or read PAGED_CARDS more paged cards.
+class CardTextStore {
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+    static const size_t DECODED_BLOCKS = 4;
+    static const size_t PAGED_CARDS = 8;
+    vector<unique_ptr<char[]>> blocks;
+    vector<unique_ptr<MappedFile>> mappings;
+    char* current = nullptr;
+    size_t remaining = 0;
+    vector<const char*> starts;
+    vector<uint32_t> frontLengths;
+    vector<uint32_t> backLengths;
+    vector<shared_ptr<const TextChunk>> chunks;
+    vector<size_t> chunkStarts;
+    size_t compressedCards = 0;
+    shared_ptr<const PagedDeckText> paged;
+    size_t pagedCards = 0;
+
+    struct DecodedBlock {
+        uint64_t chunkId = 0;
+        size_t block = 0;
+        string text;
+        vector<uint32_t> bounds;
+    };
+
+    string_view compressedText(size_t i, int part) const {
+        thread_local array<DecodedBlock, DECODED_BLOCKS> cache;
+        thread_local size_t victim = 0;
+
+        size_t c = upper_bound(chunkStarts.begin(), chunkStarts.end(), i) -
+                   chunkStarts.begin() - 1;
+        const TextChunk& chunk = *chunks[c];
+        size_t local = i - chunkStarts[c];
+        size_t block = local / TEXT_BLOCK_CARDS;
+        DecodedBlock* decoded = nullptr;
+        for (DecodedBlock& entry : cache) {
+            if (entry.chunkId == chunk.getId() && entry.block == block) decoded = &entry;
+        }
+        if (!decoded) {
+            decoded = &cache[victim++ % DECODED_BLOCKS];
+            chunk.decodeBlock(block, decoded->text, decoded->bounds);
+            decoded->chunkId = chunk.getId();
+            decoded->block = block;
+        }
+        size_t k = 2 * (local % TEXT_BLOCK_CARDS) + part;
+        if (k + 1 >= decoded->bounds.size()) return string_view();
+        return string_view(decoded->text).substr(
+            decoded->bounds[k], decoded->bounds[k + 1] - decoded->bounds[k]);
+    }
+
+    string_view pagedText(size_t i, int part) const {
+        struct PagedCard {
+            uint64_t fileId = 0;
+            size_t card = 0;
+            string text;
+            size_t frontLength = 0;
+        };
+        thread_local array<PagedCard, PAGED_CARDS> cache;
+        thread_local size_t victim = 0;
+
+        PagedCard* entry = nullptr;
+        for (PagedCard& candidate : cache) {
+            if (candidate.fileId == paged->getId() && candidate.card == i) {
+                entry = &candidate;
+            }
+        }
+        if (!entry) {
+            entry = &cache[victim++ % PAGED_CARDS];
+            long long frontLength = paged->read(i, entry->text);
+            if (frontLength < 0) {
+                entry->text.clear();
+                frontLength = 0;
+            }
+            entry->fileId = paged->getId();
+            entry->card = i;
+            entry->frontLength = frontLength;
+        }
+        string_view text = entry->text;
+        return part == 0 ? text.substr(0, entry->frontLength)
+                         : text.substr(entry->frontLength);
+    }
+
+    // Turns every compressed or paged card back into plain text, for the
+    // rare edits (merging duplicates) that move cards around.
+    void expand() {
+        if (compressedCards == 0 && pagedCards == 0) return;
+        CardTextStore plain;
+        plain.reserve(size());
+        for (size_t i = 0; i < size(); i++) plain.add(front(i), back(i));
+        *this = move(plain);
+    }
+
+    char* allocate(size_t size) {
+        if (size > remaining) {
+            if (size > BLOCK_SIZE / 4) {
+                blocks.emplace_back(new char[size]);
+                return blocks.back().get();
+            }
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            current = blocks.back().get();
+            remaining = BLOCK_SIZE;
+        }
+        char* p = current;
+        current += size;
+        remaining -= size;
+        return p;
+    }
+
+public:
+    size_t size() const { return compressedCards + pagedCards + starts.size(); }
+
+    void clear() {
+        blocks.clear();
+        mappings.clear();
+        current = nullptr;
+        remaining = 0;
+        starts.clear();
+        frontLengths.clear();
+        backLengths.clear();
+        chunks.clear();
+        chunkStarts.clear();
+        compressedCards = 0;
+        paged.reset();
+        pagedCards = 0;
+    }
+
+    void reserve(size_t n) {
+        starts.reserve(n);
+        frontLengths.reserve(n);
+        backLengths.reserve(n);
+    }
+
+    void add(string_view front, string_view back) {
+        char* p = allocate(front.size() + back.size());
+        memcpy(p, front.data(), front.size());
+        memcpy(p + front.size(), back.data(), back.size());
+        addMapped(p, front.size(), back.size());
+    }
+
+    // Records text that already lives in memory owned by the store, such as
+    // a mapping handed over with keepMapping.
+    void addMapped(const char* text, uint32_t frontLength, uint32_t backLength) {
+        starts.push_back(text);
+        frontLengths.push_back(frontLength);
+        backLengths.push_back(backLength);
+    }
+
+    // Takes over another store's cards and memory, keeping its views valid.
+    void append(CardTextStore&& other) {
+        other.expand();
+        for (auto& block : other.blocks) blocks.push_back(move(block));
+        for (auto& map : other.mappings) mappings.push_back(move(map));
+        starts.insert(starts.end(), other.starts.begin(), other.starts.end());
+        frontLengths.insert(frontLengths.end(), other.frontLengths.begin(),
+                            other.frontLengths.end());
+        backLengths.insert(backLengths.end(), other.backLengths.begin(),
+                           other.backLengths.end());
+        other.clear();
+    }
+
+    void moveCard(size_t from, size_t to) {
+        if (min(from, to) < compressedCards + pagedCards) expand();
+        from -= compressedCards + pagedCards;
+        to -= compressedCards + pagedCards;
+        starts[to] = starts[from];
+        frontLengths[to] = frontLengths[from];
+        backLengths[to] = backLengths[from];
+    }
+
+    void truncate(size_t n) {
+        if (n >= size()) return;
+        if (n < compressedCards + pagedCards) expand();
+        n -= compressedCards + pagedCards;
+        starts.resize(n);
+        frontLengths.resize(n);
+        backLengths.resize(n);
+    }
+
+    // Copies another store's card views without taking over its memory; the
+    // views stay valid until the other store is cleared.
+    void copyViews(const CardTextStore& other) {
+        chunks = other.chunks;
+        chunkStarts = other.chunkStarts;
+        compressedCards = other.compressedCards;
+        paged = other.paged;
+        pagedCards = other.pagedCards;
+        starts = other.starts;
+        frontLengths = other.frontLengths;
+        backLengths = other.backLengths;
+    }
+
+    void keepMapping(unique_ptr<MappedFile> map) {
+        mappings.push_back(move(map));
+    }
+
+    // Reads the first cards from a binary deck file on demand; the store
+    // must be empty.
+    void adoptPaged(shared_ptr<const PagedDeckText> file) {
+        pagedCards = file->cardCount();
+        paged = move(file);
+    }
+
+    const PagedDeckText* getPaged() const { return paged.get(); }
+
+    // Pulls a paged card's text into the page cache ahead of its use.
+    void prefetch(size_t i) const {
+        if (i >= compressedCards && i - compressedCards < pagedCards) {
+            paged->prefetch(i - compressedCards);
+        }
+    }
+
+    string_view front(size_t i) const {
+        if (i < compressedCards) return compressedText(i, 0);
+        i -= compressedCards;
+        if (i < pagedCards) return pagedText(i, 0);
+        i -= pagedCards;
+        return string_view(starts[i], frontLengths[i]);
+    }
+
+    string_view back(size_t i) const {
+        if (i < compressedCards) return compressedText(i, 1);
+        i -= compressedCards;
+        if (i < pagedCards) return pagedText(i, 1);
+        i -= pagedCards;
+        return string_view(starts[i] + frontLengths[i], backLengths[i]);
+    }
+
+    // Front-codes the paged and plain cards at the end into a new chunk and
+    // frees their memory. Cards added later stay plain until the next call.
+    void compress() {
+        if (size() == compressedCards) return;
+        adoptChunk(encodeTail());
+    }
+
+    // Encodes the cards after the compressed ones without changing the
+    // store, as a writer needs when saving to a compressed file.
+    shared_ptr<const TextChunk> encodeTail() const {
+        return TextChunk::encode(size() - compressedCards, [this](size_t i) {
+            return make_pair(front(compressedCards + i), back(compressedCards + i));
+        });
+    }
+
+    // Appends a chunk's cards after the compressed ones and drops the paged
+    // and plain cards, so it is only used when there are none or they were
+    // just encoded into this chunk.
+    void adoptChunk(shared_ptr<const TextChunk> chunk) {
+        chunkStarts.push_back(compressedCards);
+        compressedCards += chunk->cardCount();
+        chunks.push_back(move(chunk));
+        blocks.clear();
+        mappings.clear();
+        current = nullptr;
+        remaining = 0;
+        paged.reset();
+        pagedCards = 0;
+        starts.clear();
+        starts.shrink_to_fit();
+        frontLengths.clear();
+        frontLengths.shrink_to_fit();
+        backLengths.clear();
+        backLengths.shrink_to_fit();
+    }
+
+    const vector<shared_ptr<const TextChunk>>& getChunks() const { return chunks; }
+
+    // Bytes held for card text: chunks, plain text, the per-card views and
+    // the page cache of a paged deck.
+    size_t memoryBytes() const {
+        size_t bytes = chunkStarts.size() * sizeof(size_t);
+        if (paged) bytes += paged->getCache().residentBytes();
+        for (const auto& chunk : chunks) bytes += chunk->byteSize();
+        for (size_t i = 0; i < starts.size(); i++) {
+            bytes += frontLengths[i] + backLengths[i] + sizeof(const char*) +
+                     2 * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+};
+
+const int MINUTES_PER_HOUR = 60;
+const int MINUTES_PER_DAY = 24 * MINUTES_PER_HOUR;
+
+// Minutes since the Unix epoch, the unit of wall-clock due times.
+int wallClockMinute() { return int(time(nullptr) / 60); }
+
+// Scheduling state for every card, one contiguous array per field so scans
+// over boxes or due rounds never touch card text.
+class ProgressTable {
+private:
+    vector<int> boxes;
+    vector<int> dueRounds;
+    vector<int> reviewed;
+    vector<int> correct;
+    // Wall-clock due times in minutes, kept only once enableDueTimes is
+    // called; a round then stands for a day.
+    vector<int> dueTimes;
+    bool timed = false;
+    array<int, MAX_BOX + 1> intervals = {1, 1, 2, 4, 8, 16};
+
+    // Rows come from files that may have been edited by hand; accuracy and
+    // progress bars rely on 0 <= correct <= reviewed.
+    void clampCounters(size_t i) {
+        reviewed[i] = max(reviewed[i], 0);
+        correct[i] = min(max(correct[i], 0), reviewed[i]);
+    }
+
+public:
+    // Rounds until a card in each box is due again. Only the scheduler
+    // simulator changes these; the app always uses the defaults.
+    void setIntervals(const array<int, MAX_BOX + 1>& newIntervals) {
+        intervals = newIntervals;
+    }
+
+    size_t size() const { return boxes.size(); }
+
+    size_t memoryBytes() const {
+        return (boxes.capacity() + dueRounds.capacity() + reviewed.capacity() +
+                correct.capacity() + dueTimes.capacity()) * sizeof(int);
+    }
+
+    void clear() {
+        boxes.clear();
+        dueRounds.clear();
+        reviewed.clear();
+        correct.clear();
+        dueTimes.clear();
+    }
+
+    void reserve(size_t n) {
+        boxes.reserve(n);
+        dueRounds.reserve(n);
+        reviewed.reserve(n);
+        correct.reserve(n);
+        if (timed) dueTimes.reserve(n);
+    }
+
+    void append(const ProgressTable& other) {
+        boxes.insert(boxes.end(), other.boxes.begin(), other.boxes.end());
+        dueRounds.insert(dueRounds.end(), other.dueRounds.begin(), other.dueRounds.end());
+        reviewed.insert(reviewed.end(), other.reviewed.begin(), other.reviewed.end());
+        correct.insert(correct.end(), other.correct.begin(), other.correct.end());
+        if (timed) dueTimes.resize(boxes.size());
+    }
+
+    // New rows in a timed table are due at once.
+    void add(int box, int dueRound, int timesReviewed, int timesCorrect) {
+        boxes.push_back(box);
+        dueRounds.push_back(dueRound);
+        reviewed.push_back(timesReviewed);
+        correct.push_back(timesCorrect);
+        clampCounters(boxes.size() - 1);
+        if (timed) dueTimes.push_back(0);
+    }
+
+    void moveRow(size_t from, size_t to) {
+        boxes[to] = boxes[from];
+        dueRounds[to] = dueRounds[from];
+        reviewed[to] = reviewed[from];
+        correct[to] = correct[from];
+        if (timed) dueTimes[to] = dueTimes[from];
+    }
+
+    void truncate(size_t n) {
+        boxes.resize(n);
+        dueRounds.resize(n);
+        reviewed.resize(n);
+        correct.resize(n);
+        if (timed) dueTimes.resize(n);
+    }
+
+    // Folds row from into row into: review counters are added and the card
+    // keeps the lower box and earlier due round of the two.
+    void mergeRow(size_t into, size_t from) {
+        reviewed[into] += reviewed[from];
+        correct[into] += correct[from];
+        boxes[into] = min(boxes[into], boxes[from]);
+        dueRounds[into] = min(dueRounds[into], dueRounds[from]);
+        if (timed) dueTimes[into] = min(dueTimes[into], dueTimes[from]);
+    }
+
+    // Starts keeping due times, converting each card's due round: a card due
+    // k rounds after currentRound becomes due k days after nowMinute.
+    void enableDueTimes(int currentRound, int nowMinute) {
+        timed = true;
+        dueTimes.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            long long rounds = dueRounds[i] - currentRound;
+            long long due = nowMinute + rounds * MINUTES_PER_DAY;
+            dueTimes[i] = int(max(0LL, min<long long>(due, numeric_limits<int>::max())));
+        }
+    }
+
+    void disableDueTimes() {
+        timed = false;
+        vector<int>().swap(dueTimes);
+    }
+
+    bool hasDueTimes() const { return timed; }
+
+    int getBox(size_t i) const { return boxes[i]; }
+    int getDueRound(size_t i) const { return dueRounds[i]; }
+    int getDueTime(size_t i) const { return dueTimes[i]; }
+    void setDueTime(size_t i, int minute) { dueTimes[i] = minute; }
+    int getTimesReviewed(size_t i) const { return reviewed[i]; }
+    int getTimesCorrect(size_t i) const { return correct[i]; }
+
+    void markCorrect(size_t i, int currentRound, int nowMinute = 0) {
+        correct[i]++;
+        reviewed[i]++;
+        if (boxes[i] < MAX_BOX) boxes[i]++;
+        int interval = intervals[min(max(boxes[i], 0), MAX_BOX)];
+        dueRounds[i] = currentRound + interval;
+        if (timed) dueTimes[i] = nowMinute + interval * MINUTES_PER_DAY;
+    }
+
+    void markIncorrect(size_t i, int currentRound, int nowMinute = 0) {
+        reviewed[i]++;
+        boxes[i] = 0;
+        dueRounds[i] = currentRound + intervals[0];
+        if (timed) dueTimes[i] = nowMinute + intervals[0] * MINUTES_PER_DAY;
+    }
+
+    // Writes the four columns one after another, as in a progress file.
+    void writeArrays(ostream& out) const {
+        for (const vector<int>* column : {&boxes, &dueRounds, &reviewed, &correct}) {
+            out.write(reinterpret_cast<const char*>(column->data()),
+                      column->size() * sizeof(int));
+        }
+    }
+
+    void readArrays(const char* data, size_t count) {
+        for (vector<int>* column : {&boxes, &dueRounds, &reviewed, &correct}) {
+            column->resize(count);
+            memcpy(column->data(), data, count * sizeof(int));
+            data += count * sizeof(int);
+        }
+        for (size_t i = 0; i < count; i++) clampCounters(i);
+        if (timed) dueTimes.resize(count);
+    }
+};
+
+enum LineResult { LINE_SKIPPED, LINE_PARSED, LINE_INVALID };
+
+// Parses one line of the text deck format. Blank lines and lines without
+// exactly 6 fields are skipped; lines whose counters don't parse are
+// invalid. Legacy lines (front|back|reviewed|correct, from the cards.txt
+// generation of the app) have 4 unescaped fields and become new cards in box
+// 0 that keep their counters. parts and unescaped are scratch space reused
+// between calls.
+LineResult parseDeckLine(string_view line, CardTextStore& texts,
+                         ProgressTable& progress, vector<string_view>& parts,
+                         string& unescaped, bool legacy) {
+    string_view trimmed = trimView(line);
+    if (trimmed.empty()) return LINE_SKIPPED;
+
+    // Same splitting as getline(ss, part, '|'): a trailing '|' does not
+    // start an extra empty field. Only lines with a backslash need the slow
+    // scan that skips escaped bars.
+    bool escaped = !legacy && trimmed.find('\\') != string_view::npos;
+    parts.clear();
+    size_t start = 0;
+    while (start < trimmed.size() && parts.size() <= 6) {
+        size_t bar = start;
+        if (escaped) {
+            while (bar < trimmed.size() && trimmed[bar] != '|') {
+                bar += trimmed[bar] == '\\' ? 2 : 1;
+            }
+            bar = min(bar, trimmed.size());
+        } else {
+            bar = trimmed.find('|', start);
+            if (bar == string_view::npos) bar = trimmed.size();
+        }
+        parts.push_back(trimmed.substr(start, bar - start));
+        start = bar + 1;
+    }
+
+    if (parts.size() != (legacy ? 4 : 6)) return LINE_SKIPPED;
+
+    int box = 0, dueRound = 0, timesReviewed, timesCorrect;
+    if (legacy ? !parseInt(parts[2], timesReviewed) || !parseInt(parts[3], timesCorrect)
+               : !parseInt(parts[2], box) || !parseInt(parts[3], dueRound) ||
+                 !parseInt(parts[4], timesReviewed) || !parseInt(parts[5], timesCorrect)) {
+        return LINE_INVALID;
+    }
+    if (escaped) {
+        unescaped.clear();
+        unescapeDeckText(parts[0], unescaped);
+        size_t frontLength = unescaped.size();
+        unescapeDeckText(parts[1], unescaped);
+        string_view text(unescaped);
+        texts.add(text.substr(0, frontLength), text.substr(frontLength));
+    } else {
+        texts.add(parts[0], parts[1]);
+    }
+    progress.add(box, dueRound, timesReviewed, timesCorrect);
+    return LINE_PARSED;
+}
+
+enum DeckFormat {
+    DECK_MISSING, DECK_UNKNOWN, DECK_TEXT, DECK_LEGACY_TEXT, DECK_BINARY, DECK_COMPRESSED
+};
+
+const char* deckFormatName(DeckFormat format) {
+    static const char* const names[] = {"missing", "unknown", "text", "legacy text",
+                                        "binary", "compressed"};
+    return names[format];
+}
+
+// Tells the deck generations apart from the start of the file: a magic
+// number for binary and compressed decks, a round number on the first line
+// for text decks, and a 4-field card line for legacy cards.txt decks. An
+// empty file is an empty text deck.
+DeckFormat detectDeckFormat(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return DECK_MISSING;
+    char prefix[4096];
+    ssize_t n;
+    do {
+        n = ::read(fd, prefix, sizeof(prefix));
+    } while (n < 0 && errno == EINTR);
+    ::close(fd);
+    if (n < 0) return DECK_UNKNOWN;
+
+    string_view head(prefix, n);
+    if (head.substr(0, sizeof(DECK_MAGIC)) == string_view(DECK_MAGIC, sizeof(DECK_MAGIC))) {
+        return DECK_BINARY;
+    }
+    if (head.substr(0, sizeof(COMPRESSED_DECK_MAGIC)) ==
+        string_view(COMPRESSED_DECK_MAGIC, sizeof(COMPRESSED_DECK_MAGIC))) {
+        return DECK_COMPRESSED;
+    }
+    size_t start = 0;
+    while (start < head.size()) {
+        size_t lineEnd = min(head.find('\n', start), head.size());
+        string_view line = trimView(head.substr(start, lineEnd - start));
+        start = lineEnd + 1;
+        if (line.empty()) continue;
+        int round;
+        if (line.find('|') == string_view::npos) {
+            return parseInt(line, round) ? DECK_TEXT : DECK_UNKNOWN;
+        }
+        return count(line.begin(), line.end(), '|') == 3 ? DECK_LEGACY_TEXT : DECK_UNKNOWN;
+    }
+    return DECK_TEXT;
+}
+
+struct ParsedChunk {
+    CardTextStore texts;
+    ProgressTable progress;
+    size_t errors = 0;
+};
+
+// Lightweight view of one card: its text plus its row in the ProgressTable.
+class CardRecord {
+private:
+    const CardTextStore* texts;
+    const ProgressTable* progress;
+    size_t index;
+
+public:
+    CardRecord(const CardTextStore& t, const ProgressTable& p, size_t i)
+        : texts(&t), progress(&p), index(i) {}
+
+    string_view getFront() const { return texts->front(index); }
+    string_view getBack() const { return texts->back(index); }
+    int getBox() const { return progress->getBox(index); }
+    int getDueRound() const { return progress->getDueRound(index); }
+    int getTimesReviewed() const { return progress->getTimesReviewed(index); }
+    int getTimesCorrect() const { return progress->getTimesCorrect(index); }
+
+    double getAccuracy() const {
+        int timesReviewed = getTimesReviewed();
+        return timesReviewed > 0 ? (getTimesCorrect() * 100.0 / timesReviewed) : 0;
+    }
+
+    string getProgressBar() const {
+        const int width = 20;
+        int timesReviewed = getTimesReviewed();
+        int filled = (timesReviewed > 0) ?
+                    clamp(width * getTimesCorrect() / timesReviewed, 0, width) : 0;
+        string bar(filled, '=');
+        bar += string(width - filled, '-');
+        return "[" + bar + "]";
+    }
+};
+
+// Review journal layout: JournalHeader followed by records of
+//   op (1 byte) | payload
+// where ADD carries two uint32 lengths plus the text, CORRECT/INCORRECT
+// carry a uint32 card index and int32 round, NEXT_ROUND has no payload,
+// SET_ROUND carries the new int32 round and CLOCK the int32 wall-clock minute
+// at which the grades after it were given.
+// The header stores the fingerprint of the snapshot the journal applies to,
+// so a journal left behind by an older snapshot is never replayed.
+const char JOURNAL_MAGIC[4] = {'F', 'C', 'J', 'L'};
+const uint32_t JOURNAL_VERSION = 1;
+const size_t COMPACT_MIN_ENTRIES = 4096;
+
+enum JournalOp : uint8_t {
+    JOURNAL_ADD = 1,
+    JOURNAL_CORRECT = 2,
+    JOURNAL_INCORRECT = 3,
+    JOURNAL_NEXT_ROUND = 4,
+    JOURNAL_SET_ROUND = 5,
+    JOURNAL_CLOCK = 6
+};
+
+struct GradeEvent {
+    uint32_t card;
+    bool correct;
+    int32_t round;
+};
+
+struct JournalHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;
+};
+
+class ReviewJournal {
+private:
+    FILE* file = nullptr;
+    size_t entryCount = 0;
+    bool batching = false;
+    int32_t lastClock = numeric_limits<int32_t>::min();
+
+    void writeRecord(const char* data, size_t size) {
+        if (!file) return;
+        fwrite(data, 1, size, file);
+        if (!batching) fflush(file);
+        entryCount++;
+    }
+
+    void writeGrade(JournalOp op, uint32_t index, int32_t round) {
+        char record[9];
+        record[0] = op;
+        memcpy(record + 1, &index, 4);
+        memcpy(record + 5, &round, 4);
+        writeRecord(record, sizeof(record));
+    }
+
+public:
+    ReviewJournal() = default;
+    ReviewJournal(const ReviewJournal&) = delete;
+    ReviewJournal& operator=(const ReviewJournal&) = delete;
+    ~ReviewJournal() { close(); }
+
+    bool start(const string& path, uint64_t fingerprint) {
+        close();
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+            cerr << "Error opening journal " << path << "\n";
+            return false;
+        }
+
+        JournalHeader header = {};
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        header.version = JOURNAL_VERSION;
+        header.fingerprint = fingerprint;
+        fwrite(&header, sizeof(header), 1, file);
+        fflush(file);
+        return true;
+    }
+
+    // Continues an existing journal after its last complete record.
+    bool resume(const string& path, size_t validBytes, size_t entries) {
+        close();
+        if (truncate(path.c_str(), validBytes) != 0) return false;
+        file = fopen(path.c_str(), "ab");
+        entryCount = entries;
+        return file != nullptr;
+    }
+
+    void close() {
+        if (file) fclose(file);
+        file = nullptr;
+        entryCount = 0;
+        lastClock = numeric_limits<int32_t>::min();
+    }
+
+    bool isOpen() const { return file != nullptr; }
+    size_t getEntryCount() const { return entryCount; }
+
+    void logAdd(string_view front, string_view back) {
+        uint32_t lengths[2] = {uint32_t(front.size()), uint32_t(back.size())};
+        string record(1, char(JOURNAL_ADD));
+        record.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+        record += front;
+        record += back;
+        writeRecord(record.data(), record.size());
+    }
+
+    void logCorrect(uint32_t index, int32_t round) {
+        writeGrade(JOURNAL_CORRECT, index, round);
+    }
+
+    void logIncorrect(uint32_t index, int32_t round) {
+        writeGrade(JOURNAL_INCORRECT, index, round);
+    }
+
+    void logNextRound() {
+        char op = JOURNAL_NEXT_ROUND;
+        writeRecord(&op, 1);
+    }
+
+    void logSetRound(int32_t round) {
+        char record[5];
+        record[0] = JOURNAL_SET_ROUND;
+        memcpy(record + 1, &round, 4);
+        writeRecord(record, sizeof(record));
+    }
+
+    // Only written when the minute changes, so it costs one record per
+    // minute of grading rather than one per grade.
+    void logClock(int32_t minute) {
+        if (minute == lastClock) return;
+        lastClock = minute;
+        char record[5];
+        record[0] = JOURNAL_CLOCK;
+        memcpy(record + 1, &minute, 4);
+        writeRecord(record, sizeof(record));
+    }
+
+    // Records written between beginBatch and endBatch are flushed together.
+    void beginBatch() { batching = true; }
+
+    void endBatch() {
+        batching = false;
+        if (file) fflush(file);
+    }
+};
+
+// xoshiro256** generator: small, fast and seedable, for picking and
+// shuffling cards. The state is seeded through splitmix64 so any seed works.
+class Xoshiro256 {
+private:
+    uint64_t state[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed) {
+        for (uint64_t& word : state) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return ~uint64_t(0); }
+
+    uint64_t operator()() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform value in [0, bound) by multiply-shift instead of a division.
+    uint64_t below(uint64_t bound) {
+        return uint64_t((unsigned __int128)(*this)() * bound >> 64);
+    }
+};
+
+// Calendar queue over due rounds: one bucket of card indices per round, plus
+// each card's slot inside its bucket so a card can be moved in O(1).
+class DueIndex {
+private:
+    map<int, vector<uint32_t>> buckets;
+    vector<uint32_t> slots;
+
+    void removeFrom(uint32_t card, int round) {
+        auto it = buckets.find(round);
+        if (it == buckets.end()) return;
+        vector<uint32_t>& bucket = it->second;
+        uint32_t slot = slots[card];
+        bucket[slot] = bucket.back();
+        slots[bucket[slot]] = slot;
+        bucket.pop_back();
+        if (bucket.empty()) buckets.erase(it);
+    }
+
+    void addTo(uint32_t card, int round) {
+        vector<uint32_t>& bucket = buckets[round];
+        slots[card] = bucket.size();
+        bucket.push_back(card);
+    }
+
+public:
+    void clear() {
+        buckets.clear();
+        slots.clear();
+    }
+
+    void insert(uint32_t card, int dueRound) {
+        if (card >= slots.size()) slots.resize(card + 1);
+        addTo(card, dueRound);
+    }
+
+    void move(uint32_t card, int oldRound, int newRound) {
+        if (oldRound == newRound) return;
+        removeFrom(card, oldRound);
+        addTo(card, newRound);
+    }
+
+    // Appends every card due at or before currentRound, touching only the
+    // buckets that are actually due.
+    void collectDue(int currentRound, vector<size_t>& out) const {
+        for (auto it = buckets.begin();
+             it != buckets.end() && it->first <= currentRound; ++it) {
+            out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+    }
+
+    // Calls visit(card, dueRound) for every card due at or before
+    // currentRound, most overdue first.
+    template <typename Visit>
+    void forEachDue(int currentRound, Visit visit) const {
+        for (auto it = buckets.begin();
+             it != buckets.end() && it->first <= currentRound; ++it) {
+            for (uint32_t card : it->second) visit(card, it->first);
+        }
+    }
+
+    // Buckets in round order, so several indexes can be merged.
+    using BucketIterator = map<int, vector<uint32_t>>::const_iterator;
+    BucketIterator begin() const { return buckets.begin(); }
+    BucketIterator end() const { return buckets.end(); }
+
+    size_t countDue(int currentRound) const {
+        size_t count = 0;
+        for (auto it = buckets.begin();
+             it != buckets.end() && it->first <= currentRound; ++it) {
+            count += it->second.size();
+        }
+        return count;
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = slots.capacity() * sizeof(uint32_t);
+        for (const auto& bucket : buckets) bytes += bucket.second.capacity() * sizeof(uint32_t);
+        return bytes;
+    }
+};
+
+// Hierarchical timing wheel over due times in minutes. Cards due within the
+// current hour sit in one of 60 minute slots, cards due later today in one of
+// 24 hour slots, cards due within DAY_SLOTS days in a day slot, and anything
+// later in an overflow map keyed by day. Advancing the clock empties the
+// minute slots it passes into the due list and cascades an hour or day slot
+// one level down when it is entered, so each card moves at most three times
+// before it is due and "what is due now" is the size of the due list. Day
+// slots also keep a count per hour, so "due within N hours" adds up counters
+// instead of scanning cards.
+class TimingWheel {
+private:
+    static const int DAY_SLOTS = 256;
+    static const uint16_t DUE_BUCKET = 0;
+    static const uint16_t MINUTE_BUCKETS = 1;
+    static const uint16_t HOUR_BUCKETS = MINUTE_BUCKETS + MINUTES_PER_HOUR;
+    static const uint16_t DAY_BUCKETS = HOUR_BUCKETS + 24;
+    static const uint16_t OVERFLOW_BUCKET = DAY_BUCKETS + DAY_SLOTS;
+
+    int now = 0;
+    vector<vector<uint32_t>> buckets = vector<vector<uint32_t>>(OVERFLOW_BUCKET);
+    map<int, vector<uint32_t>> overflow;
+    array<size_t, 3> levelSizes = {};
+    vector<array<uint32_t, 24>> dayHours = vector<array<uint32_t, 24>>(DAY_SLOTS);
+    vector<int> dues;
+    vector<uint16_t> bucketOf;
+    vector<uint32_t> slots;
+
+    static int level(uint16_t bucket) {
+        return bucket >= DAY_BUCKETS ? 2 : bucket >= HOUR_BUCKETS ? 1 : 0;
+    }
+
+    vector<uint32_t>& bucketList(uint16_t bucket, int due) {
+        return bucket == OVERFLOW_BUCKET ? overflow[due / MINUTES_PER_DAY] : buckets[bucket];
+    }
+
+    uint16_t bucketFor(int due) const {
+        if (due <= now) return DUE_BUCKET;
+        if (due / MINUTES_PER_HOUR == now / MINUTES_PER_HOUR) {
+            return MINUTE_BUCKETS + due % MINUTES_PER_HOUR;
+        }
+        if (due / MINUTES_PER_DAY == now / MINUTES_PER_DAY) {
+            return HOUR_BUCKETS + due / MINUTES_PER_HOUR % 24;
+        }
+        if (due / MINUTES_PER_DAY - now / MINUTES_PER_DAY < DAY_SLOTS) {
+            return DAY_BUCKETS + due / MINUTES_PER_DAY % DAY_SLOTS;
+        }
+        return OVERFLOW_BUCKET;
+    }
+
+    void place(uint32_t card) {
+        uint16_t bucket = bucketFor(dues[card]);
+        vector<uint32_t>& list = bucketList(bucket, dues[card]);
+        bucketOf[card] = bucket;
+        slots[card] = list.size();
+        list.push_back(card);
+        if (bucket != DUE_BUCKET && bucket != OVERFLOW_BUCKET) levelSizes[level(bucket)]++;
+        if (level(bucket) == 2 && bucket != OVERFLOW_BUCKET) {
+            dayHours[bucket - DAY_BUCKETS][dues[card] / MINUTES_PER_HOUR % 24]++;
+        }
+    }
+
+    void unplace(uint32_t card) {
+        uint16_t bucket = bucketOf[card];
+        vector<uint32_t>& list = bucketList(bucket, dues[card]);
+        uint32_t slot = slots[card];
+        list[slot] = list.back();
+        slots[list[slot]] = slot;
+        list.pop_back();
+        if (bucket == OVERFLOW_BUCKET && list.empty()) {
+            overflow.erase(dues[card] / MINUTES_PER_DAY);
+        }
+        if (bucket != DUE_BUCKET && bucket != OVERFLOW_BUCKET) levelSizes[level(bucket)]--;
+        if (level(bucket) == 2 && bucket != OVERFLOW_BUCKET) {
+            dayHours[bucket - DAY_BUCKETS][dues[card] / MINUTES_PER_HOUR % 24]--;
+        }
+    }
+
+    // Moves a minute slot that the clock has reached into the due list.
+    void expire(uint16_t bucket) {
+        vector<uint32_t>& due = buckets[DUE_BUCKET];
+        levelSizes[0] -= buckets[bucket].size();
+        for (uint32_t card : buckets[bucket]) {
+            bucketOf[card] = DUE_BUCKET;
+            slots[card] = due.size();
+            due.push_back(card);
+        }
+        buckets[bucket].clear();
+    }
+
+    // Re-places every card of a bucket against the current time.
+    void cascade(uint16_t bucket) {
+        vector<uint32_t> cards;
+        cards.swap(buckets[bucket]);
+        levelSizes[level(bucket)] -= cards.size();
+        if (level(bucket) == 2) dayHours[bucket - DAY_BUCKETS] = {};
+        for (uint32_t card : cards) place(card);
+    }
+
+
+public:
+    void clear(int start) {
+        now = start;
+        for (auto& bucket : buckets) bucket.clear();
+        overflow.clear();
+        levelSizes = {};
+        for (auto& hours : dayHours) hours = {};
+        dues.clear();
+        bucketOf.clear();
+        slots.clear();
+    }
+
+    int getNow() const { return now; }
+
+    void insert(uint32_t card, int due) {
+        if (card >= dues.size()) {
+            dues.resize(card + 1);
+            bucketOf.resize(card + 1);
+            slots.resize(card + 1);
+        }
+        dues[card] = due;
+        place(card);
+    }
+
+    void move(uint32_t card, int due) {
+        unplace(card);
+        dues[card] = due;
+        place(card);
+    }
+
+    // Moves the clock forward to target, minute by minute through occupied
+    // hours and an hour at a time through empty ones.
+    void advance(int target) {
+        while (now < target) {
+            int hourEnd = (now / MINUTES_PER_HOUR + 1) * MINUTES_PER_HOUR;
+            int stop = min(target, hourEnd - 1);
+            if (levelSizes[0] > 0) {
+                for (int minute = now + 1; minute <= stop; minute++) {
+                    expire(MINUTE_BUCKETS + minute % MINUTES_PER_HOUR);
+                }
+            }
+            now = stop;
+            if (now == target) break;
+
+            now = hourEnd;
+            if (now % MINUTES_PER_DAY == 0) {
+                int day = now / MINUTES_PER_DAY;
+                cascade(DAY_BUCKETS + day % DAY_SLOTS);
+                while (!overflow.empty() && overflow.begin()->first < day + DAY_SLOTS) {
+                    vector<uint32_t> cards = std::move(overflow.begin()->second);
+                    overflow.erase(overflow.begin());
+                    for (uint32_t card : cards) place(card);
+                }
+            }
+            cascade(HOUR_BUCKETS + now / MINUTES_PER_HOUR % 24);
+            expire(MINUTE_BUCKETS + now % MINUTES_PER_HOUR);
+        }
+    }
+
+    size_t countDue() const { return buckets[DUE_BUCKET].size(); }
+
+    // Calls visit(card, due) for every card due by the wheel's clock.
+    template <typename Visit>
+    void forEachDue(Visit visit) const {
+        for (uint32_t card : buckets[DUE_BUCKET]) visit(card, dues[card]);
+    }
+
+    // Counts the cards due by limit. Within the current hour the count is
+    // exact to the minute; past it, whole hours are counted, up to the end of
+    // the hour holding limit. Only counters are read, except for the partly
+    // covered day of an overflow query more than DAY_SLOTS days ahead.
+    size_t countDueBy(int limit) const {
+        size_t count = countDue();
+        int hour = now / MINUTES_PER_HOUR;
+        int day = now / MINUTES_PER_DAY;
+        int hourEnd = (hour + 1) * MINUTES_PER_HOUR;
+        for (int minute = now + 1; minute < hourEnd && minute <= limit; minute++) {
+            count += buckets[MINUTE_BUCKETS + minute % MINUTES_PER_HOUR].size();
+        }
+        int lastHour = limit / MINUTES_PER_HOUR;
+        for (int h = hour + 1; h < (day + 1) * 24 && h <= lastHour; h++) {
+            count += buckets[HOUR_BUCKETS + h % 24].size();
+        }
+        for (int d = day + 1; d < day + DAY_SLOTS && d * 24 <= lastHour; d++) {
+            size_t slot = d % DAY_SLOTS;
+            if ((d + 1) * 24 - 1 <= lastHour) {
+                count += buckets[DAY_BUCKETS + slot].size();
+            } else {
+                for (int h = 0; h <= lastHour % 24; h++) count += dayHours[slot][h];
+            }
+        }
+        for (auto it = overflow.begin(); it != overflow.end() && it->first * 24 <= lastHour;
+             ++it) {
+            for (uint32_t card : it->second) count += dues[card] / MINUTES_PER_HOUR <= lastHour;
+        }
+        return count;
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = dues.capacity() * sizeof(int) + bucketOf.capacity() * sizeof(uint16_t) +
+                       slots.capacity() * sizeof(uint32_t);
+        for (const auto& bucket : buckets) bytes += bucket.capacity() * sizeof(uint32_t);
+        for (const auto& entry : overflow) bytes += entry.second.capacity() * sizeof(uint32_t);
+        return bytes;
+    }
+};
+
+struct AnswerMatch {
+    bool accepted;
+    int distance;
+};
+
+// Grades typed answers with some tolerance. Both answers are normalized
+// (UTF-8 aware, through lookup tables) into buffers owned by the checker, then compared
+// with a bit-parallel (Myers/Hyyro) edit distance, once as typed and once
+// with their words sorted. After the first few calls nothing is allocated.
+class AnswerChecker {
+private:
+    string user, correct;
+    string userSorted, correctSorted;
+    vector<string_view> tokens;
+    vector<uint64_t> peq;
+    vector<uint64_t> pv, mv;
+    int typoPercent = 20;
+    bool ignoreWordOrder = true;
+
+    // Maps ASCII letters and digits to lowercase and everything else to 0.
+    static const char* foldTable() {
+        static const auto table = [] {
+            array<char, 128> t = {};
+            for (int c = '0'; c <= '9'; c++) t[c] = c;
+            for (int c = 'a'; c <= 'z'; c++) t[c] = c;
+            for (int c = 'A'; c <= 'Z'; c++) t[c] = c - 'A' + 'a';
+            return t;
+        }();
+        return table.data();
+    }
+
+    // What a code point normalizes to: itself or another code point,
+    // FOLD_SEPARATOR for punctuation and symbols, FOLD_IGNORED for marks
+    // dropped without splitting a word, or FOLD_PAIR + k for a letter
+    // written as the two ASCII letters FOLD_PAIRS[k].
+    static const uint16_t FOLD_SEPARATOR = 0;
+    static const uint16_t FOLD_PAIR = 0xFFF0;
+    static const uint16_t FOLD_IGNORED = 0xFFFF;
+    static constexpr char FOLD_PAIRS[][3] = {"ae", "th", "ss", "ij", "oe"};
+
+    // Folding of U+0000..U+04FF: Latin letters lose case and accents, Greek
+    // and Cyrillic letters lose case and the accents that don't make a
+    // separate letter, combining accents are dropped and Latin-1 symbols
+    // separate words. Latin Extended-B and IPA are kept as they are.
+    static const uint16_t* unicodeFoldTable() {
+        static const auto table = [] {
+            array<uint16_t, 0x500> t = {};
+            for (int c = 0; c < 0x80; c++) t[c] = uint8_t(foldTable()[c]);
+            t[0xAA] = 'a';
+            t[0xBA] = 'o';
+            t[0xB2] = '2';
+            t[0xB3] = '3';
+            t[0xB9] = '1';
+            t[0xB5] = 0x3BC;
+            t[0xAD] = FOLD_IGNORED;
+            // U+00C0..U+017F by base letter; '*' marks the pairs set below.
+            const char* latin =
+                "aaaaaa*ceeeeiiiidnooooo ouuuuy**aaaaaa*ceeeeiiiidnooooo ouuuuy*y"
+                "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii**jjkkklllllll"
+                "lllnnnnnnnnnoooooo**rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+            for (int k = 0; k < 0xC0; k++) {
+                t[0xC0 + k] = latin[k] == ' ' ? FOLD_SEPARATOR : uint8_t(latin[k]);
+            }
+            t[0xC6] = t[0xE6] = FOLD_PAIR + 0;
+            t[0xDE] = t[0xFE] = FOLD_PAIR + 1;
+            t[0xDF] = FOLD_PAIR + 2;
+            t[0x132] = t[0x133] = FOLD_PAIR + 3;
+            t[0x152] = t[0x153] = FOLD_PAIR + 4;
+            for (int c = 0x180; c < 0x300; c++) t[c] = c;
+            for (int c = 0x300; c < 0x370; c++) t[c] = FOLD_IGNORED;
+
+            for (int c = 0x370; c < 0x500; c++) t[c] = c;
+            for (int c : {0x375, 0x37E, 0x384, 0x385, 0x387, 0x482}) t[c] = FOLD_SEPARATOR;
+            for (int c = 0x483; c <= 0x489; c++) t[c] = FOLD_IGNORED;
+            for (int c = 0x391; c <= 0x3A9; c++) {
+                if (c != 0x3A2) t[c] = c + 0x20;
+            }
+            static const uint16_t greekAccents[][2] = {
+                {0x386, 0x3B1}, {0x388, 0x3B5}, {0x389, 0x3B7}, {0x38A, 0x3B9},
+                {0x38C, 0x3BF}, {0x38E, 0x3C5}, {0x38F, 0x3C9}, {0x390, 0x3B9},
+                {0x3AA, 0x3B9}, {0x3AB, 0x3C5}, {0x3AC, 0x3B1}, {0x3AD, 0x3B5},
+                {0x3AE, 0x3B7}, {0x3AF, 0x3B9}, {0x3B0, 0x3C5}, {0x3C2, 0x3C3},
+                {0x3CA, 0x3B9}, {0x3CB, 0x3C5}, {0x3CC, 0x3BF}, {0x3CD, 0x3C5},
+                {0x3CE, 0x3C9}};
+            for (const auto& accent : greekAccents) t[accent[0]] = accent[1];
+
+            for (int c = 0x400; c < 0x410; c++) t[c] = c + 0x50;
+            for (int c = 0x410; c < 0x430; c++) t[c] = c + 0x20;
+            for (int c = 0x460; c < 0x482; c += 2) t[c] = c + 1;
+            for (int c = 0x48A; c < 0x4C0; c += 2) t[c] = c + 1;
+            for (int c = 0x4C1; c < 0x4CF; c += 2) t[c] = c + 1;
+            for (int c = 0x4D0; c < 0x500; c += 2) t[c] = c + 1;
+            t[0x4C0] = 0x4CF;
+            for (int c = 0x400; c < 0x500; c++) {
+                if (t[c] == 0x450 || t[c] == 0x451) t[c] = 0x435;
+                if (t[c] == 0x45D) t[c] = 0x438;
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    static uint32_t foldCodePoint(uint32_t c) {
+        if (c < 0x500) return unicodeFoldTable()[c];
+        if (c >= 0xFF01 && c <= 0xFF5E) return uint8_t(foldTable()[c - 0xFF01 + '!']);
+        if ((c >= 0x200B && c <= 0x200D) || c == 0x2060 || c == 0xFEFF ||
+            (c >= 0x1AB0 && c <= 0x1AFF) || (c >= 0x1DC0 && c <= 0x1DFF) ||
+            (c >= 0x20D0 && c <= 0x20FF) || (c >= 0xFE00 && c <= 0xFE0F) ||
+            (c >= 0xFE20 && c <= 0xFE2F)) {
+            return FOLD_IGNORED;
+        }
+        if ((c >= 0x2000 && c <= 0x2BFF) || (c >= 0x3000 && c <= 0x303F) ||
+            (c >= 0xFE30 && c <= 0xFE6F) || (c >= 0xFF00 && c <= 0xFF65) ||
+            (c >= 0xFFF0 && c <= 0xFFFF) || (c >= 0x1F000 && c <= 0x1FAFF)) {
+            return FOLD_SEPARATOR;
+        }
+        return c;
+    }
+
+    // Decodes the UTF-8 sequence at str[i] into c and returns its length,
+    // or 0 if it is truncated, overlong or a surrogate.
+    static size_t decodeUtf8(string_view str, size_t i, uint32_t& c) {
+        static const uint32_t minimum[5] = {0, 0, 0x80, 0x800, 0x10000};
+        unsigned char lead = str[i];
+        size_t length = lead >= 0xF8 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 :
+                        lead >= 0xC0 ? 2 : 0;
+        if (length == 0 || str.size() - i < length) return 0;
+        c = lead & (0x7F >> length);
+        for (size_t k = 1; k < length; k++) {
+            unsigned char next = str[i + k];
+            if ((next & 0xC0) != 0x80) return 0;
+            c = c << 6 | (next & 0x3F);
+        }
+        if (c < minimum[length] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return 0;
+        return length;
+    }
+
+    // Normalizes the character at str[i], advancing i past it, into out.
+    // Returns the bytes written (never more than were read), 0 for a word
+    // separator, or -1 for a mark dropped within a word. Malformed UTF-8
+    // bytes are separators.
+    static int foldNext(string_view str, size_t& i, char* out) {
+        unsigned char lead = str[i];
+        if (lead < 0x80) {
+            i++;
+            char folded = foldTable()[lead];
+            *out = folded;
+            return folded ? 1 : 0;
+        }
+        uint32_t c;
+        size_t length;
+        if (lead >= 0xC2 && lead < 0xD4 && i + 1 < str.size() &&
+            (uint8_t(str[i + 1]) & 0xC0) == 0x80) {
+            // Two-byte Latin, Greek and Cyrillic letters, straight from the table.
+            c = (lead & 0x1F) << 6 | (uint8_t(str[i + 1]) & 0x3F);
+            length = 2;
+        } else {
+            length = decodeUtf8(str, i, c);
+        }
+        i += max<size_t>(length, 1);
+        if (length == 0) return 0;
+        uint32_t folded = foldCodePoint(c);
+        if (folded == FOLD_SEPARATOR) return 0;
+        if (folded == FOLD_IGNORED) return -1;
+        if (folded >= FOLD_PAIR && folded < FOLD_PAIR + size(FOLD_PAIRS)) {
+            memcpy(out, FOLD_PAIRS[folded - FOLD_PAIR], 2);
+            return 2;
+        }
+        if (folded < 0x80) {
+            *out = char(folded);
+            return 1;
+        }
+        if (folded < 0x800) {
+            out[0] = char(0xC0 | folded >> 6);
+            out[1] = char(0x80 | (folded & 0x3F));
+            return 2;
+        }
+        if (folded < 0x10000) {
+            out[0] = char(0xE0 | folded >> 12);
+            out[1] = char(0x80 | (folded >> 6 & 0x3F));
+            out[2] = char(0x80 | (folded & 0x3F));
+            return 3;
+        }
+        out[0] = char(0xF0 | folded >> 18);
+        out[1] = char(0x80 | (folded >> 12 & 0x3F));
+        out[2] = char(0x80 | (folded >> 6 & 0x3F));
+        out[3] = char(0x80 | (folded & 0x3F));
+        return 4;
+    }
+
+    // Whether the single character ch is whitespace or a control character.
+    static bool isSpace(string_view ch) {
+        if (ch.size() == 1) return uint8_t(ch[0]) <= ' ' || ch[0] == 0x7F;
+        uint32_t c;
+        if (decodeUtf8(ch, 0, c) == 0) return false;
+        return c < 0xA1 || c == 0x1680 || (c >= 0x2000 && c <= 0x200A) ||
+               c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000;
+    }
+
+    // Yields the normalized bytes of a string one at a time. With
+    // keepSymbols, punctuation and symbols are passed through as written
+    // and only whitespace separates.
+    struct FoldedBytes {
+        string_view str;
+        bool keepSymbols;
+        size_t i = 0;
+        char buffer[4];
+        int length = 0;
+        int pos = 0;
+
+        explicit FoldedBytes(string_view s, bool keep = false) : str(s), keepSymbols(keep) {}
+
+        // Returns the next normalized byte, or -1 at the end.
+        int next() {
+            while (pos == length) {
+                if (i == str.size()) return -1;
+                size_t start = i;
+                length = foldNext(str, i, buffer);
+                if (length == 0 && keepSymbols && !isSpace(str.substr(start, i - start))) {
+                    length = i - start;
+                    memcpy(buffer, str.data() + start, length);
+                }
+                length = max(length, 0);
+                pos = 0;
+            }
+            return uint8_t(buffer[pos++]);
+        }
+    };
+
+    // Writes the answer's words separated by single spaces.
+    static void normalizeWords(string_view in, string& out) {
+        out.resize(in.size());
+        size_t n = 0;
+        for (size_t i = 0; i < in.size();) {
+            int written = foldNext(in, i, &out[n]);
+            if (written > 0) {
+                n += written;
+            } else if (written == 0 && n > 0 && out[n - 1] != ' ') {
+                out[n++] = ' ';
+            }
+        }
+        if (n > 0 && out[n - 1] == ' ') n--;
+        out.resize(n);
+    }
+
+    void sortWords(const string& words, string& out) {
+        tokens.clear();
+        size_t start = 0;
+        while (start < words.size()) {
+            size_t space = words.find(' ', start);
+            if (space == string::npos) space = words.size();
+            tokens.push_back(string_view(words).substr(start, space - start));
+            start = space + 1;
+        }
+        sort(tokens.begin(), tokens.end());
+        out.clear();
+        for (string_view token : tokens) out += token;
+    }
+
+    static void removeSpaces(string& str) {
+        str.erase(std::remove(str.begin(), str.end(), ' '), str.end());
+    }
+
+    // Myers' block step: advances one 64-row block of the pattern by one
+    // text character and returns the horizontal delta at its last row.
+    int advanceBlock(size_t b, uint64_t eq, int hin, uint64_t lastBit) {
+        uint64_t p = pv[b], m = mv[b];
+        uint64_t xv = eq | m;
+        if (hin < 0) eq |= 1;
+        uint64_t xh = (((eq & p) + p) ^ p) | eq;
+        uint64_t ph = m | ~(xh | p);
+        uint64_t mh = p & xh;
+
+        int hout = 0;
+        if (ph & lastBit) hout = 1;
+        else if (mh & lastBit) hout = -1;
+
+        ph <<= 1;
+        mh <<= 1;
+        if (hin < 0) mh |= 1;
+        else if (hin > 0) ph |= 1;
+
+        pv[b] = mh | ~(xv | ph);
+        mv[b] = ph & xv;
+        return hout;
+    }
+
+public:
+    void setTypoPercent(int percent) { typoPercent = percent; }
+    void setIgnoreWordOrder(bool ignore) { ignoreWordOrder = ignore; }
+
+    // Writes the letters and digits of str as UTF-8, lowercased and without
+    // accents, into out and returns how many bytes were written; out needs
+    // room for str.size() bytes. ASCII goes through a single table lookup.
+    static size_t normalizeInto(string_view str, char* out) {
+        const char* fold = foldTable();
+        size_t n = 0;
+        for (size_t i = 0; i < str.size();) {
+            unsigned char c = str[i];
+            if (c < 0x80) {
+                char folded = fold[c];
+                if (folded) out[n++] = folded;
+                i++;
+            } else {
+                n += max(foldNext(str, i, out + n), 0);
+            }
+        }
+        return n;
+    }
+
+    // Hash of the normalized form of str, continuing from seed.
+    static uint64_t normalizedHash(string_view str,
+                                   uint64_t seed = 1469598103934665603ULL) {
+        const char* fold = foldTable();
+        uint64_t hash = seed;
+        char buffer[4];
+        for (size_t i = 0; i < str.size();) {
+            unsigned char c = str[i];
+            if (c < 0x80) {
+                char folded = fold[c];
+                if (folded) {
+                    hash ^= uint8_t(folded);
+                    hash *= 1099511628211ULL;
+                }
+                i++;
+                continue;
+            }
+            int written = foldNext(str, i, buffer);
+            for (int k = 0; k < written; k++) {
+                hash ^= uint8_t(buffer[k]);
+                hash *= 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    // Compares the normalized forms of a and b without building them.
+    static bool sameNormalized(string_view a, string_view b) {
+        FoldedBytes x(a), y(b);
+        while (true) {
+            int p = x.next();
+            if (p != y.next()) return false;
+            if (p < 0) return true;
+        }
+    }
+
+    // Hash and comparison of duplicate keys: the normalized form with
+    // punctuation and symbols kept, so case, accents and spacing don't make
+    // a new card but "C++" and "C#", or "2+2" and "22", stay apart.
+    static uint64_t duplicateKeyHash(string_view str,
+                                     uint64_t seed = 1469598103934665603ULL) {
+        FoldedBytes bytes(str, true);
+        uint64_t hash = seed;
+        for (int b = bytes.next(); b >= 0; b = bytes.next()) {
+            hash ^= uint8_t(b);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static bool sameDuplicateKey(string_view a, string_view b) {
+        FoldedBytes x(a, true), y(b, true);
+        while (true) {
+            int p = x.next();
+            if (p != y.next()) return false;
+            if (p < 0) return true;
+        }
+    }
+
+    // Levenshtein distance between a and b, or limit + 1 if it exceeds limit.
+    int editDistance(string_view a, string_view b, int limit) {
+        if (a.size() > b.size()) swap(a, b);
+        if (int(b.size() - a.size()) > limit) return limit + 1;
+        if (a.empty()) return b.size();
+
+        size_t blocks = (a.size() + 63) / 64;
+        if (peq.size() < blocks * 256) peq.resize(blocks * 256);
+        pv.assign(blocks, ~0ULL);
+        mv.assign(blocks, 0);
+        for (size_t i = 0; i < a.size(); i++) {
+            peq[size_t(static_cast<unsigned char>(a[i])) * blocks + i / 64] |=
+                1ULL << (i % 64);
+        }
+
+        uint64_t lastBit = 1ULL << ((a.size() - 1) % 64);
+        int score = a.size();
+        for (unsigned char c : b) {
+            const uint64_t* eq = &peq[size_t(c) * blocks];
+            int carry = 1;
+            for (size_t block = 0; block < blocks; block++) {
+                uint64_t bit = block + 1 == blocks ? lastBit : 1ULL << 63;
+                carry = advanceBlock(block, eq[block], carry, bit);
+            }
+            score += carry;
+        }
+
+        for (unsigned char c : a) {
+            fill_n(&peq[size_t(c) * blocks], blocks, 0);
+        }
+        return min(score, limit + 1);
+    }
+
+    bool exactMatch(string_view userAnswer, string_view correctAnswer) {
+        user.resize(userAnswer.size());
+        correct.resize(correctAnswer.size());
+        size_t u = normalizeInto(userAnswer, &user[0]);
+        size_t c = normalizeInto(correctAnswer, &correct[0]);
+        return string_view(user.data(), u) == string_view(correct.data(), c);
+    }
+
+    AnswerMatch check(string_view userAnswer, string_view correctAnswer) {
+        normalizeWords(userAnswer, user);
+        normalizeWords(correctAnswer, correct);
+        if (ignoreWordOrder) {
+            sortWords(user, userSorted);
+            sortWords(correct, correctSorted);
+        }
+        removeSpaces(user);
+        removeSpaces(correct);
+
+        int limit = correct.size() * typoPercent / 100;
+        int distance = editDistance(user, correct, limit);
+        if (ignoreWordOrder && distance > 0) {
+            distance = min(distance, editDistance(userSorted, correctSorted, limit));
+        }
+        return {!correct.empty() && distance <= limit, distance};
+    }
+};
+
+// Trigram index over the normalized text of card fronts and backs (the
+// normalization of AnswerChecker::normalizeInto). Each trigram maps to the
+// ascending list of cards containing it. Cards are indexed in order, so the
+// index can be extended as cards are added and saved next to the deck.
+const char SEARCH_MAGIC[4] = {'F', 'C', 'T', 'I'};
+const uint32_t SEARCH_VERSION = 2;
+
+struct SearchIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t cardCount;
+    uint64_t textHash;
+    uint64_t trigramCount;
+};
+
+class TrigramIndex {
+private:
+    unordered_map<uint32_t, vector<uint32_t>> postings;
+    size_t indexedCards = 0;
+    string scratch;
+
+    static uint32_t trigramAt(const char* p) {
+        return uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[1])) << 8 |
+               uint8_t(p[2]);
+    }
+
+    void addText(uint32_t card, string_view text) {
+        scratch.resize(text.size());
+        size_t n = AnswerChecker::normalizeInto(text, &scratch[0]);
+        for (size_t i = 0; i + 3 <= n; i++) {
+            vector<uint32_t>& list = postings[trigramAt(&scratch[i])];
+            if (list.empty() || list.back() != card) list.push_back(card);
+        }
+    }
+
+public:
+    size_t getIndexedCards() const { return indexedCards; }
+
+    size_t memoryBytes() const {
+        size_t bytes = postings.bucket_count() * sizeof(void*);
+        for (const auto& entry : postings) {
+            bytes += sizeof(entry) + entry.second.capacity() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    void clear() {
+        postings.clear();
+        indexedCards = 0;
+    }
+
+    void addCard(string_view front, string_view back) {
+        addText(indexedCards, front);
+        addText(indexedCards, back);
+        indexedCards++;
+    }
+
+    // Cards that contain every trigram of every normalized word of at
+    // least 3 characters. Returns false if no word was long enough to
+    // narrow the search, in which case every card is a candidate.
+    bool candidates(const vector<string>& words, vector<uint32_t>& out) const {
+        static const vector<uint32_t> none;
+        vector<const vector<uint32_t>*> lists;
+        for (const string& word : words) {
+            for (size_t i = 0; i + 3 <= word.size(); i++) {
+                auto it = postings.find(trigramAt(&word[i]));
+                lists.push_back(it == postings.end() ? &none : &it->second);
+            }
+        }
+        out.clear();
+        if (lists.empty()) return false;
+
+        sort(lists.begin(), lists.end(),
+             [](const vector<uint32_t>* a, const vector<uint32_t>* b) {
+                 return a->size() < b->size();
+             });
+        out = *lists[0];
+        for (size_t l = 1; l < lists.size() && !out.empty(); l++) {
+            const vector<uint32_t>& list = *lists[l];
+            size_t kept = 0;
+            auto it = list.begin();
+            for (uint32_t card : out) {
+                it = lower_bound(it, list.end(), card);
+                if (it == list.end()) break;
+                if (*it == card) out[kept++] = card;
+            }
+            out.resize(kept);
+        }
+        return true;
+    }
+
+    bool save(const string& path, uint64_t textHash) const {
+        ofstream file(path, ios::binary);
+        SearchIndexHeader header = {};
+        memcpy(header.magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC));
+        header.version = SEARCH_VERSION;
+        header.cardCount = indexedCards;
+        header.textHash = textHash;
+        header.trigramCount = postings.size();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& [trigram, list] : postings) {
+            uint32_t sizes[2] = {trigram, uint32_t(list.size())};
+            file.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+            file.write(reinterpret_cast<const char*>(list.data()),
+                       list.size() * sizeof(uint32_t));
+        }
+        return bool(file);
+    }
+
+    // Reads a saved index of at most cardCount cards. textHashFor(n) must
+    // return the hash of the first n cards' text, so an index built from
+    // other text is rejected. A truncated or damaged file leaves the index
+    // empty: every posting list must be ascending and name indexed cards, as
+    // candidates and addCard rely on.
+    template <typename HashFn>
+    bool load(const string& path, size_t cardCount, HashFn textHashFor) {
+        MappedFile map;
+        SearchIndexHeader header;
+        if (!map.open(path) || map.size() < sizeof(header)) return false;
+        memcpy(&header, map.begin(), sizeof(header));
+        if (memcmp(header.magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC)) != 0 ||
+            header.version != SEARCH_VERSION || header.cardCount > cardCount ||
+            textHashFor(header.cardCount) != header.textHash) {
+            return false;
+        }
+
+        clear();
+        const char* p = map.begin() + sizeof(header);
+        const char* end = map.begin() + map.size();
+        for (uint64_t t = 0; t < header.trigramCount; t++) {
+            uint32_t sizes[2];
+            if (end - p < 8) {
+                clear();
+                return false;
+            }
+            memcpy(sizes, p, sizeof(sizes));
+            p += sizeof(sizes);
+            vector<uint32_t>& list = postings[sizes[0]];
+            if (!list.empty() || uint64_t(end - p) < uint64_t(sizes[1]) * 4) {
+                clear();
+                return false;
+            }
+            list.resize(sizes[1]);
+            memcpy(list.data(), p, sizes[1] * 4);
+            p += sizes[1] * 4;
+            for (size_t i = 0; i < list.size(); i++) {
+                if (list[i] >= header.cardCount || (i > 0 && list[i] <= list[i - 1])) {
+                    clear();
+                    return false;
+                }
+            }
+        }
+        indexedCards = header.cardCount;
+        return true;
+    }
+};
+
+// Open-addressing hash set of cards keyed by the hash of their normalized
+// front (and optionally back). Lookups and inserts are O(1); callers confirm
+// a hash match by comparing the texts.
+class DuplicateIndex {
+private:
+    vector<uint64_t> hashes;
+    vector<uint32_t> cards;
+    size_t count = 0;
+
+    void rehash(size_t capacity) {
+        vector<uint64_t> oldHashes = move(hashes);
+        vector<uint32_t> oldCards = move(cards);
+        hashes.assign(capacity, 0);
+        cards.assign(capacity, 0);
+        count = 0;
+        for (size_t i = 0; i < oldHashes.size(); i++) {
+            if (oldHashes[i]) insertNew(oldHashes[i], oldCards[i]);
+        }
+    }
+
+    void insertNew(uint64_t hash, uint32_t card) {
+        size_t mask = hashes.size() - 1;
+        size_t slot = hash & mask;
+        while (hashes[slot]) slot = (slot + 1) & mask;
+        hashes[slot] = hash;
+        cards[slot] = card;
+        count++;
+    }
+
+public:
+    void clear() {
+        hashes.clear();
+        cards.clear();
+        count = 0;
+    }
+
+    void reserve(size_t n) {
+        size_t capacity = 1024;
+        while (capacity < n * 2) capacity *= 2;
+        if (capacity > hashes.size()) rehash(capacity);
+    }
+
+    // Returns the first indexed card with this hash for which sameKey(card)
+    // holds, or -1.
+    template <typename SameKey>
+    long long find(uint64_t hash, SameKey sameKey) const {
+        if (hash == 0) hash = 1;
+        if (hashes.empty()) return -1;
+        size_t mask = hashes.size() - 1;
+        for (size_t slot = hash & mask; hashes[slot]; slot = (slot + 1) & mask) {
+            if (hashes[slot] == hash && sameKey(cards[slot])) return cards[slot];
+        }
+        return -1;
+    }
+
+    size_t memoryBytes() const {
+        return hashes.capacity() * sizeof(uint64_t) + cards.capacity() * sizeof(uint32_t);
+    }
+
+    // Like find, but inserts card when no match exists.
+    template <typename SameKey>
+    long long findOrInsert(uint64_t hash, uint32_t card, SameKey sameKey) {
+        if (hash == 0) hash = 1;
+        if ((count + 1) * 2 > hashes.size()) {
+            rehash(max<size_t>(1024, hashes.size() * 2));
+        }
+        size_t mask = hashes.size() - 1;
+        size_t slot = hash & mask;
+        while (hashes[slot]) {
+            if (hashes[slot] == hash && sameKey(cards[slot])) return cards[slot];
+            slot = (slot + 1) & mask;
+        }
+        hashes[slot] = hash;
+        cards[slot] = card;
+        count++;
+        return -1;
+    }
+};
+
+// Running totals over the whole deck, kept up to date by every change so
+// summary views never have to scan the cards. Boxes outside 0..MAX_BOX
+// (only possible in hand-edited files) are not counted in boxCounts.
+struct DeckStats {
+    long long totalReviews = 0;
+    long long totalCorrect = 0;
+    array<size_t, MAX_BOX + 1> boxCounts = {};
+};
+
+bool writeTextDeck(const string& filename, const CardTextStore& texts,
+                   const ProgressTable& progress, int currentRound) {
+    ofstream file(filename);
+    if (!file) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+
+    auto writeText = [&](string_view text) { file.write(text.data(), text.size()); };
+    file << currentRound << "\n";
+    for (size_t i = 0; i < progress.size(); i++) {
+        escapeDeckText(texts.front(i), writeText);
+        file << "|";
+        escapeDeckText(texts.back(i), writeText);
+        file << "|" << progress.getBox(i) << "|" << progress.getDueRound(i) << "|"
+             << progress.getTimesReviewed(i) << "|"
+             << progress.getTimesCorrect(i) << "\n";
+    }
+    if (!file.flush()) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool writeBinaryDeck(const string& filename, const CardTextStore& texts,
+                     const ProgressTable& progress, int currentRound) {
+    ofstream file(filename, ios::binary);
+    if (!file) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+
+    BinaryDeckHeader header = {};
+    memcpy(header.magic, DECK_MAGIC, sizeof(DECK_MAGIC));
+    header.version = DECK_VERSION;
+    header.currentRound = currentRound;
+    header.cardCount = progress.size();
+
+    vector<BinaryCardEntry> entries(progress.size());
+    for (size_t i = 0; i < progress.size(); i++) {
+        string_view front = texts.front(i);
+        string_view back = texts.back(i);
+        BinaryCardEntry& e = entries[i];
+        e.box = progress.getBox(i);
+        e.dueRound = progress.getDueRound(i);
+        e.timesReviewed = progress.getTimesReviewed(i);
+        e.timesCorrect = progress.getTimesCorrect(i);
+        e.textOffset = header.textSize;
+        e.frontLength = front.size();
+        e.backLength = back.size();
+        header.textSize += front.size() + back.size();
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(BinaryCardEntry));
+    for (size_t i = 0; i < progress.size(); i++) {
+        string_view front = texts.front(i);
+        string_view back = texts.back(i);
+        file.write(front.data(), front.size());
+        file.write(back.data(), back.size());
+    }
+
+    if (!file) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool writeCompressedDeck(const string& filename, const CardTextStore& texts,
+                         const ProgressTable& progress, int currentRound) {
+    ofstream file(filename, ios::binary);
+    if (!file) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+
+    vector<shared_ptr<const TextChunk>> chunks = texts.getChunks();
+    size_t compressed = 0;
+    for (const auto& chunk : chunks) compressed += chunk->cardCount();
+    if (compressed < texts.size()) chunks.push_back(texts.encodeTail());
+
+    CompressedDeckHeader header = {};
+    memcpy(header.magic, COMPRESSED_DECK_MAGIC, sizeof(COMPRESSED_DECK_MAGIC));
+    header.version = COMPRESSED_DECK_VERSION;
+    header.currentRound = currentRound;
+    header.chunkCount = chunks.size();
+    header.cardCount = progress.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    progress.writeArrays(file);
+    for (const auto& chunk : chunks) file.write(chunk->bytes(), chunk->byteSize());
+
+    if (!file) {
+        cerr << "Error saving to " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Writes filename in the format given by the extension of target, the name
+// the file is saved under once it is committed.
+bool writeDeckFile(const string& filename, const string& target, const CardTextStore& texts,
+                   const ProgressTable& progress, int currentRound) {
+    METRIC_TIMER(METRIC_SAVE);
+    bool written =
+        hasSuffix(target, ".bin")   ? writeBinaryDeck(filename, texts, progress, currentRound)
+        : hasSuffix(target, ".fcz") ? writeCompressedDeck(filename, texts, progress, currentRound)
+                                    : writeTextDeck(filename, texts, progress, currentRound);
+    struct stat st;
+    if (written && stat(filename.c_str(), &st) == 0) METRIC_BYTES(METRIC_SAVE, st.st_size);
+    return written;
+}
+
+// Flushes a finished temporary file to disk and renames it over filename, so
+// a crash at any point leaves either the old file or the new one.
+bool commitFile(const string& tmp, const string& filename) {
+    int fd = ::open(tmp.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    if (!synced || rename(tmp.c_str(), filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    size_t slash = filename.rfind('/');
+    string dir = slash == string::npos ? "." : filename.substr(0, slash + 1);
+    fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+    return true;
+}
+
+bool writeDueTimes(const string& filename, const ProgressTable& progress,
+                   uint64_t fingerprint) {
+    ofstream file(filename, ios::binary);
+    DueTimesHeader header = {};
+    memcpy(header.magic, DUE_TIMES_MAGIC, sizeof(DUE_TIMES_MAGIC));
+    header.version = DUE_TIMES_VERSION;
+    header.cardCount = progress.size();
+    header.fingerprint = fingerprint;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t i = 0; i < progress.size(); i++) {
+        int32_t due = progress.getDueTime(i);
+        file.write(reinterpret_cast<const char*>(&due), sizeof(due));
+    }
+    return bool(file.flush());
+}
+
+// Approximate bytes a deck holds in memory, by part.
+struct DeckMemory {
+    size_t scheduling = 0;
+    size_t indexes = 0;
+    size_t text = 0;
+    size_t textCache = 0;
+    size_t textCacheCapacity = 0;
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+};
+
+// A point-in-time copy of a deck for saving in the background. Card text is
+// shared with the deck instead of copied, since text memory never moves while
+// cards are added; only the per-card views and progress rows are duplicated,
+// into buffers that are reused from one snapshot to the next.
+struct DeckSnapshot {
+    int currentRound = 0;
+    uint64_t fingerprint = 0;
+    CardTextStore texts;
+    ProgressTable progress;
+};
+
+const size_t DECK_SHARDS = 32;
+
+// Cards are spread over shards by index, each with its own lock, due index
+// (holding index / DECK_SHARDS) and running totals, so grades for cards in
+// different shards never contend.
+struct DeckShard {
+    mutable mutex lock;
+    DueIndex due;
+    // Used instead of due when the deck schedules by wall clock. Queries
+    // advance it to the current minute, so it is mutable like the lock.
+    mutable TimingWheel wheel;
+    DeckStats stats;
+};
+
+class Deck {
+private:
+    CardTextStore texts;
+    ProgressTable progress;
+    int currentRound = 0;
+    array<DeckShard, DECK_SHARDS> shards;
+    ReviewJournal journal;
+    string journalPath;
+    AnswerChecker checker;
+    TrigramIndex searchIndex;
+    size_t savedSearchCards = 0;
+    string searchIndexPath;
+    bool searchIndexUsed = false;
+    DuplicateIndex duplicates;
+    size_t duplicatesIndexed = 0;
+    bool duplicateKeyIncludesBack = false;
+    bool compressText = false;
+    size_t textCacheBytes = 0;
+    // stateMutex is held exclusively to add cards, change the round or take
+    // a snapshot, and shared while single cards are graded under their
+    // shard's lock; journalMutex then orders the journal writes. saveMutex
+    // keeps snapshot writes, checkpoints and resets from overlapping.
+    mutable shared_mutex stateMutex;
+    mutex journalMutex;
+    mutex saveMutex;
+
+    DeckShard& shardOf(size_t card) { return shards[card % DECK_SHARDS]; }
+    static uint32_t localIndex(size_t card) { return card / DECK_SHARDS; }
+
+    static void countBox(DeckShard& shard, int box, int delta) {
+        if (box >= 0 && box <= MAX_BOX) shard.stats.boxCounts[box] += delta;
+    }
+
+    uint64_t duplicateHash(string_view front, string_view back) const {
+        uint64_t hash = AnswerChecker::duplicateKeyHash(front);
+        if (duplicateKeyIncludesBack) {
+            hash = AnswerChecker::duplicateKeyHash(back, hash ^ 0x9e3779b97f4a7c15ULL);
+        }
+        return hash;
+    }
+
+    bool sameKey(size_t card, string_view front, string_view back) const {
+        return AnswerChecker::sameDuplicateKey(texts.front(card), front) &&
+               (!duplicateKeyIncludesBack ||
+                AnswerChecker::sameDuplicateKey(texts.back(card), back));
+    }
+
+    // Finds the card that duplicates this text, or registers card as its
+    // owner and returns -1.
+    long long findOrAddDuplicate(string_view front, string_view back, size_t card) {
+        return duplicates.findOrInsert(
+            duplicateHash(front, back), card,
+            [&](uint32_t other) { return sameKey(other, front, back); });
+    }
+
+    // Catches the duplicate index up with the cards. Loading leaves it
+    // empty, so a deck's text is only hashed once a card is added. Cards
+    // that duplicate an earlier one are kept; only the first is indexed.
+    void indexDuplicates() {
+        if (duplicatesIndexed == texts.size()) return;
+        duplicates.reserve(texts.size());
+        for (size_t i = duplicatesIndexed; i < texts.size(); i++) {
+            findOrAddDuplicate(texts.front(i), texts.back(i), i);
+        }
+        duplicatesIndexed = texts.size();
+    }
+
+    // Folds cards that duplicate an earlier card into it in one pass and
+    // compacts the deck. Returns how many cards were merged away.
+    size_t mergeDuplicates() {
+        duplicates.clear();
+        duplicates.reserve(progress.size());
+        size_t kept = 0;
+        for (size_t i = 0; i < progress.size(); i++) {
+            long long original = findOrAddDuplicate(texts.front(i), texts.back(i), kept);
+            if (original >= 0) {
+                progress.mergeRow(original, i);
+                continue;
+            }
+            if (kept != i) {
+                texts.moveCard(i, kept);
+                progress.moveRow(i, kept);
+            }
+            kept++;
+        }
+        size_t merged = progress.size() - kept;
+        texts.truncate(kept);
+        progress.truncate(kept);
+        duplicatesIndexed = kept;
+        if (merged > 0) cout << "Merged " << merged << " duplicate cards\n";
+        return merged;
+    }
+
+    string normalizeString(const string& str) {
+        string result(str.size(), '\0');
+        result.resize(AnswerChecker::normalizeInto(str, &result[0]));
+        return result;
+    }
+
+    // Files a card under its due round, or its due time when the deck
+    // schedules by wall clock.
+    void insertDue(size_t card) {
+        DeckShard& shard = shardOf(card);
+        if (progress.hasDueTimes()) {
+            shard.wheel.insert(localIndex(card), progress.getDueTime(card));
+        } else {
+            shard.due.insert(localIndex(card), progress.getDueRound(card));
+        }
+    }
+
+    void moveDue(size_t card, int oldDueRound) {
+        DeckShard& shard = shardOf(card);
+        if (progress.hasDueTimes()) {
+            shard.wheel.move(localIndex(card), progress.getDueTime(card));
+        } else {
+            shard.due.move(localIndex(card), oldDueRound, progress.getDueRound(card));
+        }
+    }
+
+    bool appendCard(string_view front, string_view back) {
+        if (front.empty() || back.empty()) return false;
+        indexDuplicates();
+        if (findOrAddDuplicate(front, back, texts.size()) >= 0) return false;
+        duplicatesIndexed++;
+        texts.add(front, back);
+        progress.add(0, 0, 0, 0);
+        size_t card = texts.size() - 1;
+        insertDue(card);
+        countBox(shardOf(card), 0, 1);
+        return true;
+    }
+
+    // Merges the shards' due rounds from the earliest, taking whole rounds
+    // until limit is reached, so the work is bounded by limit rather than by
+    // the number of due cards. The last, partly taken round is sampled with
+    // a Fisher-Yates shuffle over its positions that records only the
+    // entries it swaps.
+    void collectDueByRound(Xoshiro256& rng, size_t limit, vector<size_t>& due) const {
+        array<DueIndex::BucketIterator, DECK_SHARDS> next;
+        for (size_t s = 0; s < DECK_SHARDS; s++) next[s] = shards[s].due.begin();
+        while (due.size() < limit) {
+            int round = currentRound + 1;
+            for (size_t s = 0; s < DECK_SHARDS; s++) {
+                if (next[s] != shards[s].due.end()) round = min(round, next[s]->first);
+            }
+            if (round > currentRound) break;
+
+            auto inRound = [&](size_t s) {
+                return next[s] != shards[s].due.end() && next[s]->first == round;
+            };
+            size_t total = 0;
+            for (size_t s = 0; s < DECK_SHARDS; s++) {
+                if (inRound(s)) total += next[s]->second.size();
+            }
+            size_t need = limit - due.size();
+            if (total > need) {
+                auto cardAt = [&](size_t i) {
+                    for (size_t s = 0;; s++) {
+                        if (!inRound(s)) continue;
+                        const vector<uint32_t>& bucket = next[s]->second;
+                        if (i < bucket.size()) return size_t(bucket[i]) * DECK_SHARDS + s;
+                        i -= bucket.size();
+                    }
+                };
+                unordered_map<size_t, size_t> swapped;
+                for (size_t i = 0; i < need; i++) {
+                    size_t j = i + rng.below(total - i);
+                    auto at = [&](size_t k) {
+                        auto it = swapped.find(k);
+                        return it == swapped.end() ? k : it->second;
+                    };
+                    size_t picked = at(j);
+                    swapped[j] = at(i);
+                    due.push_back(cardAt(picked));
+                }
+                break;
+            }
+            for (size_t s = 0; s < DECK_SHARDS; s++) {
+                if (!inRound(s)) continue;
+                for (uint32_t local : next[s]->second) {
+                    due.push_back(local * DECK_SHARDS + s);
+                }
+                ++next[s];
+            }
+        }
+    }
+
+    // The timing wheels keep due cards in one unordered list, so the most
+    // overdue are found by selecting on due time, and only the cards due at
+    // the cutoff minute are sampled.
+    void collectDueByTime(Xoshiro256& rng, size_t limit, vector<size_t>& due) const {
+        int now = wallClockMinute();
+        using Candidate = pair<int, size_t>;
+        vector<Candidate> candidates;
+        for (size_t s = 0; s < DECK_SHARDS; s++) {
+            shards[s].wheel.advance(now);
+            shards[s].wheel.forEachDue([&](uint32_t local, int dueTime) {
+                candidates.emplace_back(dueTime, local * DECK_SHARDS + s);
+            });
+        }
+        if (candidates.size() > limit) {
+            auto byDue = [](const Candidate& a, const Candidate& b) { return a.first < b.first; };
+            nth_element(candidates.begin(), candidates.begin() + limit, candidates.end(),
+                        byDue);
+            int cutoff = candidates[limit].first;
+            auto ties = partition(candidates.begin(), candidates.end(),
+                                  [cutoff](const Candidate& c) { return c.first < cutoff; });
+            auto tiesEnd = partition(ties, candidates.end(),
+                                     [cutoff](const Candidate& c) { return c.first == cutoff; });
+            size_t first = ties - candidates.begin();
+            size_t count = tiesEnd - ties;
+            for (size_t i = 0; i < limit - first; i++) {
+                swap(ties[i], ties[i + rng.below(count - i)]);
+            }
+            candidates.resize(limit);
+        }
+        due.reserve(candidates.size());
+        for (const auto& candidate : candidates) due.push_back(candidate.second);
+    }
+
+    void rebuildDueIndexes() {
+        int now = wallClockMinute();
+        for (DeckShard& shard : shards) {
+            shard.due.clear();
+            shard.wheel.clear(now);
+        }
+        for (size_t i = 0; i < progress.size(); i++) insertDue(i);
+    }
+
+    // Called whenever the card set is replaced: rebuilds the due index and
+    // drops the search and duplicate indexes, which catch up lazily on the
+    // next search or added card. Paged cards are never hashed for the
+    // duplicate index, so on a paged deck only cards added since loading
+    // are checked against each other.
+    void rebuildIndexes() {
+        searchIndex.clear();
+        savedSearchCards = 0;
+        searchIndexUsed = false;
+        duplicates.clear();
+        duplicatesIndexed = texts.getPaged() ? texts.size() : 0;
+        for (DeckShard& shard : shards) shard.stats = DeckStats();
+        for (size_t i = 0; i < progress.size(); i++) {
+            DeckShard& shard = shardOf(i);
+            shard.stats.totalReviews += progress.getTimesReviewed(i);
+            shard.stats.totalCorrect += progress.getTimesCorrect(i);
+            countBox(shard, progress.getBox(i), 1);
+        }
+        rebuildDueIndexes();
+    }
+
+    // minute is the wall-clock time of the grade, used when the deck
+    // schedules by wall clock.
+    void applyCorrect(size_t index, int round, int minute) {
+        DeckShard& shard = shardOf(index);
+        int oldDue = progress.getDueRound(index);
+        countBox(shard, progress.getBox(index), -1);
+        progress.markCorrect(index, round, minute);
+        countBox(shard, progress.getBox(index), 1);
+        shard.stats.totalReviews++;
+        shard.stats.totalCorrect++;
+        moveDue(index, oldDue);
+    }
+
+    void applyIncorrect(size_t index, int round, int minute) {
+        DeckShard& shard = shardOf(index);
+        int oldDue = progress.getDueRound(index);
+        countBox(shard, progress.getBox(index), -1);
+        progress.markIncorrect(index, round, minute);
+        countBox(shard, 0, 1);
+        shard.stats.totalReviews++;
+        moveDue(index, oldDue);
+    }
+
+    // Applies journal records on top of the loaded snapshot. Returns false if
+    // the journal is missing or belongs to a different snapshot; otherwise
+    // reports how many bytes and records were intact.
+    bool replayJournal(const string& path, size_t& validBytes, size_t& entries) {
+        MappedFile map;
+        JournalHeader header;
+        if (!map.open(path) || map.size() < sizeof(header)) return false;
+        memcpy(&header, map.begin(), sizeof(header));
+        if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 ||
+            header.version != JOURNAL_VERSION ||
+            header.fingerprint != fingerprint()) {
+            return false;
+        }
+
+        const char* p = map.begin() + sizeof(header);
+        const char* end = map.begin() + map.size();
+        int32_t minute = wallClockMinute();
+        entries = 0;
+        while (p < end) {
+            uint8_t op = *p;
+            if (op == JOURNAL_NEXT_ROUND) {
+                currentRound++;
+                p += 1;
+            } else if (op == JOURNAL_SET_ROUND) {
+                if (end - p < 5) break;
+                memcpy(&currentRound, p + 1, 4);
+                p += 5;
+            } else if (op == JOURNAL_CLOCK) {
+                if (end - p < 5) break;
+                memcpy(&minute, p + 1, 4);
+                p += 5;
+            } else if (op == JOURNAL_CORRECT || op == JOURNAL_INCORRECT) {
+                if (end - p < 9) break;
+                uint32_t index;
+                int32_t round;
+                memcpy(&index, p + 1, 4);
+                memcpy(&round, p + 5, 4);
+                if (index >= progress.size()) break;
+                if (op == JOURNAL_CORRECT) applyCorrect(index, round, minute);
+                else applyIncorrect(index, round, minute);
+                p += 9;
+            } else if (op == JOURNAL_ADD) {
+                uint32_t lengths[2];
+                if (end - p < 9) break;
+                memcpy(lengths, p + 1, sizeof(lengths));
+                if (uint64_t(end - p - 9) < uint64_t(lengths[0]) + lengths[1]) break;
+                const char* text = p + 9;
+                appendCard(string_view(text, lengths[0]),
+                           string_view(text + lengths[0], lengths[1]));
+                p += 9 + lengths[0] + lengths[1];
+            } else {
+                break;
+            }
+            entries++;
+        }
+
+        validBytes = p - map.begin();
+        if (p < end) {
+            cerr << "Journal " << path << " has a damaged tail, "
+                 << (end - p) << " bytes ignored\n";
+        }
+        return true;
+    }
+
+    // Starts a new journal for the state about to be saved. The records so
+    // far move to the ".old" journal, which is kept until the save completes
+    // so a crash mid-save still recovers from the previous snapshot.
+    void rotateJournal(uint64_t snapshotFingerprint) {
+        string oldPath = journalPath + ".old";
+        journal.close();
+        FILE* pending = fopen(oldPath.c_str(), "rb+");
+        if (!pending) {
+            rename(journalPath.c_str(), oldPath.c_str());
+        } else {
+            // An earlier save never completed, so its journal still leads
+            // from the snapshot on disk; extend it with this one's records.
+            MappedFile map;
+            if (map.open(journalPath) && map.size() > sizeof(JournalHeader)) {
+                fseek(pending, 0, SEEK_END);
+                fwrite(map.begin() + sizeof(JournalHeader), 1,
+                       map.size() - sizeof(JournalHeader), pending);
+            }
+            fclose(pending);
+        }
+        journal.start(journalPath, snapshotFingerprint);
+    }
+
+public:
+    // When set, cards only count as duplicates if their backs match too.
+    // Set before loading.
+    void setDuplicateKeyIncludesBack(bool includeBack) {
+        duplicateKeyIncludesBack = includeBack;
+    }
+
+    // When set, card text is front-coded in memory after loading and only
+    // decoded a block at a time when a card is read. Applies from the next
+    // load; .fcz decks always stay compressed.
+    void setCompressText(bool compress) { compressText = compress; }
+    size_t textMemoryBytes() const { return texts.memoryBytes(); }
+
+    // When non-zero, binary decks leave their card text on disk and read it
+    // through an LRU page cache of at most this many bytes, so only the
+    // scheduling state and indexes stay in memory. Applies from the next
+    // load, and takes precedence over setCompressText for binary decks.
+    void setTextCacheBytes(size_t bytes) { textCacheBytes = bytes; }
+    bool pagesText() const { return texts.getPaged() != nullptr; }
+
+    // Reads a card's text into the page cache so showing it later does no
+    // I/O. Safe to call from another thread while cards are graded.
+    void prefetchText(size_t card) const {
+        shared_lock<shared_mutex> lock(stateMutex);
+        if (card < texts.size()) texts.prefetch(card);
+    }
+
+    DeckMemory memoryUsage() const {
+        shared_lock<shared_mutex> lock(stateMutex);
+        DeckMemory memory;
+        memory.scheduling = progress.memoryBytes();
+        for (const DeckShard& shard : shards) {
+            lock_guard<mutex> shardLock(shard.lock);
+            memory.scheduling += shard.due.memoryBytes() + shard.wheel.memoryBytes();
+        }
+        memory.indexes = duplicates.memoryBytes() + searchIndex.memoryBytes();
+        memory.text = texts.memoryBytes();
+        if (const PagedDeckText* paged = texts.getPaged()) {
+            const PageCache& cache = paged->getCache();
+            memory.textCache = cache.residentBytes();
+            memory.text -= min(memory.text, memory.textCache);
+            memory.textCacheCapacity = cache.capacityBytes();
+            tie(memory.cacheHits, memory.cacheMisses) = cache.hitsAndMisses();
+        }
+        return memory;
+    }
+
+    // Returns the index of an existing card with the same normalized key,
+    // or -1.
+    long long findDuplicate(string_view front, string_view back) {
+        indexDuplicates();
+        return duplicates.find(duplicateHash(front, back), [&](uint32_t other) {
+            return sameKey(other, front, back);
+        });
+    }
+
+    void addCard(const FlashCard& card) {
+        unique_lock<shared_mutex> lock(stateMutex);
+        long long existing = findDuplicate(card.front, card.back);
+        if (existing >= 0) {
+            cout << "This card already exists (Card #" << (existing + 1) << ")\n";
+            return;
+        }
+        if (appendCard(card.front, card.back)) {
+            journal.logAdd(card.front, card.back);
+            cout << "Card added successfully!\n";
+        }
+    }
+
+    // Adds the cards produced by next(front, back) until it returns false,
+    // skipping empty and duplicate cards. Imports are not journaled, so the
+    // caller checkpoints afterwards. Returns how many cards were added.
+    template <typename NextCard>
+    size_t importCards(size_t expected, NextCard next) {
+        unique_lock<shared_mutex> lock(stateMutex);
+        texts.reserve(texts.size() + expected);
+        progress.reserve(progress.size() + expected);
+        duplicates.reserve(progress.size() + expected);
+        size_t added = 0;
+        string_view front, back;
+        while (next(front, back)) {
+            if (appendCard(front, back)) added++;
+        }
+        return added;
+    }
+
+    // Folds every card that duplicates an earlier one into it, adding up
+    // their counters. Loading never does this; it is the --dedup command.
+    size_t removeDuplicates() {
+        unique_lock<shared_mutex> lock(stateMutex);
+        // Merging moves cards, which would pull a paged deck's text into memory.
+        if (texts.getPaged()) return 0;
+        size_t merged = mergeDuplicates();
+        if (merged > 0) rebuildIndexes();
+        return merged;
+    }
+
+    CardRecord getRecord(size_t index) const {
+        return CardRecord(texts, progress, index);
+    }
+    const ProgressTable& getProgress() const { return progress; }
+    const CardTextStore& getContent() const { return texts; }
+
+    // Sums the shards' running totals; O(DECK_SHARDS), independent of the
+    // number of cards.
+    DeckStats getStats() const {
+        shared_lock<shared_mutex> lock(stateMutex);
+        DeckStats total;
+        for (const DeckShard& shard : shards) {
+            lock_guard<mutex> shardLock(shard.lock);
+            total.totalReviews += shard.stats.totalReviews;
+            total.totalCorrect += shard.stats.totalCorrect;
+            for (int box = 0; box <= MAX_BOX; box++) {
+                total.boxCounts[box] += shard.stats.boxCounts[box];
+            }
+        }
+        return total;
+    }
+    size_t getCardCount() const { return progress.size(); }
+
+    int nextRound() {
+        unique_lock<shared_mutex> lock(stateMutex);
+        currentRound++;
+        journal.logNextRound();
+        return currentRound;
+    }
+    int getCurrentRound() const { return currentRound; }
+
+    // Grades one card and returns its new box. Safe to call from several
+    // threads at once.
+    int markCorrect(size_t index) {
+        METRIC_TIMER(METRIC_GRADE);
+        int minute = wallClockMinute();
+        shared_lock<shared_mutex> lock(stateMutex);
+        lock_guard<mutex> shardLock(shardOf(index).lock);
+        applyCorrect(index, currentRound, minute);
+        lock_guard<mutex> logLock(journalMutex);
+        if (progress.hasDueTimes()) journal.logClock(minute);
+        journal.logCorrect(index, currentRound);
+        return progress.getBox(index);
+    }
+
+    int markIncorrect(size_t index) {
+        METRIC_TIMER(METRIC_GRADE);
+        int minute = wallClockMinute();
+        shared_lock<shared_mutex> lock(stateMutex);
+        lock_guard<mutex> shardLock(shardOf(index).lock);
+        applyIncorrect(index, currentRound, minute);
+        lock_guard<mutex> logLock(journalMutex);
+        if (progress.hasDueTimes()) journal.logClock(minute);
+        journal.logIncorrect(index, currentRound);
+        return progress.getBox(index);
+    }
+
+    // Applies grades without any console output, journaling them as one
+    // batch. Events for unknown cards are skipped; a later round moves the
+    // deck's current round forward. Returns how many events were applied.
+    size_t applyGrades(const vector<GradeEvent>& events) {
+        unique_lock<shared_mutex> lock(stateMutex);
+        size_t applied = 0;
+        int minute = wallClockMinute();
+        journal.beginBatch();
+        if (progress.hasDueTimes() && !events.empty()) journal.logClock(minute);
+        for (const GradeEvent& e : events) {
+            if (e.card >= progress.size()) continue;
+            if (e.round > currentRound) {
+                currentRound = e.round;
+                journal.logSetRound(currentRound);
+            }
+            if (e.correct) {
+                applyCorrect(e.card, e.round, minute);
+                journal.logCorrect(e.card, e.round);
+            } else {
+                applyIncorrect(e.card, e.round, minute);
+                journal.logIncorrect(e.card, e.round);
+            }
+            applied++;
+        }
+        journal.endBatch();
+        return applied;
+    }
+
+    void reset() {
+        lock_guard<mutex> saving(saveMutex);
+        unique_lock<shared_mutex> lock(stateMutex);
+        texts.clear();
+        progress.clear();
+        progress.disableDueTimes();
+        for (DeckShard& shard : shards) {
+            shard.due.clear();
+            shard.wheel.clear(wallClockMinute());
+            shard.stats = DeckStats();
+        }
+        duplicates.clear();
+        duplicatesIndexed = 0;
+        searchIndex.clear();
+        savedSearchCards = 0;
+        searchIndexUsed = false;
+        currentRound = 0;
+        if (!journalPath.empty()) {
+            remove((journalPath + ".old").c_str());
+            journal.start(journalPath, fingerprint());
+        }
+    }
+
+    // Identifies a deck state so a journal can be matched to its snapshot.
+    uint64_t fingerprint() const {
+        uint64_t hash = 1469598103934665603ULL;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ULL;
+        };
+        mix(currentRound);
+        mix(progress.size());
+        for (size_t i = 0; i < progress.size(); i++) {
+            mix(progress.getBox(i));
+            mix(uint32_t(progress.getDueRound(i)));
+            mix(progress.getTimesReviewed(i));
+            mix(progress.getTimesCorrect(i));
+        }
+        return hash;
+    }
+
+    // Replays any journal written since the loaded snapshot, then keeps
+    // appending every change to it. A ".old" journal left by an unfinished
+    // background save is replayed first, as it leads from the snapshot on
+    // disk to the state the current journal starts from.
+    bool attachJournal(const string& path) {
+        journalPath = path;
+        string oldPath = path + ".old";
+        size_t validBytes = 0;
+        size_t oldEntries = 0;
+        if (!replayJournal(oldPath, validBytes, oldEntries)) remove(oldPath.c_str());
+
+        size_t entries = 0;
+        bool resumable = replayJournal(path, validBytes, entries);
+        if (oldEntries + entries > 0) {
+            cout << "Recovered " << (oldEntries + entries) << " journaled changes\n";
+        }
+        if (resumable && journal.resume(path, validBytes, entries)) return true;
+        return journal.start(path, fingerprint());
+    }
+
+    bool needsCompaction() const {
+        return journal.getEntryCount() >=
+               max(COMPACT_MIN_ENTRIES, progress.size() / 4);
+    }
+
+    // Folds the journal into a fresh snapshot written via a temporary file.
+    bool checkpoint(const string& filename) {
+        lock_guard<mutex> saving(saveMutex);
+        unique_lock<shared_mutex> lock(stateMutex);
+        string tmp = filename + ".tmp";
+        if (!writeDeckFile(tmp, filename, texts, progress, currentRound) ||
+            !commitFile(tmp, filename)) {
+            cerr << "Error saving to " << filename << "\n";
+            remove(tmp.c_str());
+            return false;
+        }
+        uint64_t print = fingerprint();
+        if (progress.hasDueTimes()) {
+            string timesTmp = filename + ".times.tmp";
+            if (!writeDueTimes(timesTmp, progress, print) ||
+                !commitFile(timesTmp, filename + ".times")) {
+                cerr << "Error saving to " << filename << ".times\n";
+                remove(timesTmp.c_str());
+                return false;
+            }
+        }
+        if (!journalPath.empty()) {
+            remove((journalPath + ".old").c_str());
+            journal.start(journalPath, print);
+        }
+        cout << "Saved " << progress.size() << " cards to " << filename << "\n";
+        return true;
+    }
+
+    // Writes the deck to filename through snapshot if it changed since the
+    // last save. The deck is only locked while its state is copied, so other
+    // threads can keep grading cards during the write. Returns whether a new
+    // file was written.
+    bool autosave(const string& filename, DeckSnapshot& snapshot) {
+        lock_guard<mutex> saving(saveMutex);
+        {
+            unique_lock<shared_mutex> lock(stateMutex);
+            if (journalPath.empty() || journal.getEntryCount() == 0) return false;
+            snapshot.currentRound = currentRound;
+            snapshot.fingerprint = fingerprint();
+            snapshot.texts.copyViews(texts);
+            snapshot.progress = progress;
+            rotateJournal(snapshot.fingerprint);
+        }
+        string tmp = filename + ".autosave";
+        if (!writeDeckFile(tmp, filename, snapshot.texts, snapshot.progress,
+                           snapshot.currentRound) ||
+            !commitFile(tmp, filename)) {
+            remove(tmp.c_str());
+            return false;
+        }
+        if (snapshot.progress.hasDueTimes()) {
+            string timesTmp = filename + ".times.autosave";
+            if (!writeDueTimes(timesTmp, snapshot.progress, snapshot.fingerprint) ||
+                !commitFile(timesTmp, filename + ".times")) {
+                remove(timesTmp.c_str());
+                return false;
+            }
+        }
+        remove((journalPath + ".old").c_str());
+        return true;
+    }
+
+    size_t countDue() const {
+        shared_lock<shared_mutex> lock(stateMutex);
+        int now = wallClockMinute();
+        size_t count = 0;
+        for (const DeckShard& shard : shards) {
+            lock_guard<mutex> shardLock(shard.lock);
+            if (progress.hasDueTimes()) {
+                shard.wheel.advance(now);
+                count += shard.wheel.countDue();
+            } else {
+                count += shard.due.countDue(currentRound);
+            }
+        }
+        return count;
+    }
+
+    // Cards due now or within the next minutes, by wall clock. Decks that
+    // schedule by rounds have no notion of time and report countDue().
+    size_t countDueWithin(int minutes) const {
+        if (!progress.hasDueTimes()) return countDue();
+        shared_lock<shared_mutex> lock(stateMutex);
+        int now = wallClockMinute();
+        size_t count = 0;
+        for (const DeckShard& shard : shards) {
+            lock_guard<mutex> shardLock(shard.lock);
+            shard.wheel.advance(now);
+            count += shard.wheel.countDueBy(now + minutes);
+        }
+        return count;
+    }
+
+    bool usesWallClock() const { return progress.hasDueTimes(); }
+
+    // Switches to wall-clock scheduling: a card due k rounds from now
+    // becomes due k days from now.
+    void useWallClock() {
+        unique_lock<shared_mutex> lock(stateMutex);
+        if (progress.hasDueTimes()) return;
+        progress.enableDueTimes(currentRound, wallClockMinute());
+        rebuildDueIndexes();
+    }
+
+    // Schedules by wall clock if path holds due times, which are kept by
+    // checkpoint and autosave from then on. Call after load and before
+    // attachJournal. Times saved with a different deck state are dropped and
+    // the cards rescheduled from their due rounds. Returns whether the deck
+    // now schedules by wall clock.
+    bool loadDueTimes(const string& path) {
+        MappedFile map;
+        if (!map.open(path)) return false;
+        unique_lock<shared_mutex> lock(stateMutex);
+        progress.enableDueTimes(currentRound, wallClockMinute());
+        DueTimesHeader header = {};
+        if (map.size() >= sizeof(header)) memcpy(&header, map.begin(), sizeof(header));
+        if (memcmp(header.magic, DUE_TIMES_MAGIC, sizeof(DUE_TIMES_MAGIC)) == 0 &&
+            header.version == DUE_TIMES_VERSION && header.cardCount == progress.size() &&
+            (map.size() - sizeof(header)) / sizeof(int32_t) >= header.cardCount &&
+            header.fingerprint == fingerprint()) {
+            const char* p = map.begin() + sizeof(header);
+            for (size_t i = 0; i < progress.size(); i++, p += sizeof(int32_t)) {
+                int32_t due;
+                memcpy(&due, p, sizeof(due));
+                progress.setDueTime(i, due);
+            }
+        } else if (progress.size() > 0) {
+            cerr << "Due times in " << path
+                 << " do not match the deck; rescheduling from rounds\n";
+        }
+        rebuildDueIndexes();
+        return true;
+    }
+
+    // Returns up to limit due cards in random order, choosing the most
+    // overdue ones and breaking ties at random. The deck's storage order, and
+    // everything indexed by it, is left alone.
+    vector<size_t> getDueCards(Xoshiro256& rng,
+                               size_t limit = numeric_limits<size_t>::max()) const {
+        METRIC_TIMER(METRIC_DUE_CARDS);
+        shared_lock<shared_mutex> lock(stateMutex);
+        vector<size_t> due;
+        {
+            // Grades lock a single shard, so taking every shard in order
+            // cannot deadlock against them.
+            array<unique_lock<mutex>, DECK_SHARDS> shardLocks;
+            for (size_t s = 0; s < DECK_SHARDS; s++) {
+                shardLocks[s] = unique_lock<mutex>(shards[s].lock);
+            }
+            if (progress.hasDueTimes()) {
+                collectDueByTime(rng, limit, due);
+            } else {
+                collectDueByRound(rng, limit, due);
+            }
+        }
+        // Fisher-Yates shuffle
+        for (size_t i = due.size(); i-- > 1;) {
+            swap(due[i], due[rng.below(i + 1)]);
+        }
+        return due;
+    }
+
+    bool checkAnswer(string_view userAnswer, string_view correctAnswer) {
+        METRIC_TIMER(METRIC_CHECK_ANSWER);
+        return checker.exactMatch(userAnswer, correctAnswer);
+    }
+
+    AnswerMatch gradeTypedAnswer(string_view userAnswer, string_view correctAnswer) {
+        METRIC_TIMER(METRIC_CHECK_ANSWER);
+        return checker.check(userAnswer, correctAnswer);
+    }
+
+    // Writes the deck through a temporary file, like checkpoint. Card text
+    // may still be mapped from filename itself (a .bin or .fcz deck saved
+    // over its source), so the old file must stay intact until the rename.
+    // A symlinked deck is replaced where the link points; devices and pipes
+    // such as /dev/stdout are written directly.
+    bool save(const string& filename) {
+        struct stat st;
+        bool exists = stat(filename.c_str(), &st) == 0;
+        if (exists && !S_ISREG(st.st_mode)) {
+            if (!writeDeckFile(filename, filename, texts, progress, currentRound)) {
+                return false;
+            }
+        } else {
+            string target = filename;
+            if (char* resolved = exists ? realpath(filename.c_str(), nullptr) : nullptr) {
+                target = resolved;
+                free(resolved);
+            }
+            string tmp = target + ".tmp";
+            if (!writeDeckFile(tmp, filename, texts, progress, currentRound) ||
+                !commitFile(tmp, target)) {
+                cerr << "Error saving to " << filename << "\n";
+                remove(tmp.c_str());
+                return false;
+            }
+        }
+        cout << "Saved " << progress.size() << " cards to " << filename << "\n";
+        return true;
+    }
+
+    bool loadBinary(const string& filename) {
+        auto mapping = make_unique<MappedFile>();
+        const MappedFile& map = *mapping;
+        if (!mapping->open(filename)) {
+            cerr << "No save file found, starting fresh\n";
+            return false;
+        }
+
+        BinaryDeckHeader header;
+        if (map.size() < sizeof(header)) {
+            cerr << "Error parsing card data\n";
+            return false;
+        }
+        memcpy(&header, map.begin(), sizeof(header));
+
+        uint64_t tableSize = header.cardCount * sizeof(BinaryCardEntry);
+        if (header.version != DECK_VERSION ||
+            header.cardCount > map.size() / sizeof(BinaryCardEntry) ||
+            map.size() - sizeof(header) < tableSize ||
+            map.size() - sizeof(header) - tableSize < header.textSize) {
+            cerr << "Unsupported or truncated deck file " << filename << "\n";
+            return false;
+        }
+
+        if (textCacheBytes > 0 && loadPaged(filename, header)) return true;
+
+        const char* table = map.begin() + sizeof(header);
+        const char* text = table + tableSize;
+
+        texts.clear();
+        progress.clear();
+        texts.reserve(header.cardCount);
+        progress.reserve(header.cardCount);
+        currentRound = header.currentRound;
+
+        for (uint64_t i = 0; i < header.cardCount; i++) {
+            BinaryCardEntry e;
+            memcpy(&e, table + i * sizeof(e), sizeof(e));
+            uint64_t length = uint64_t(e.frontLength) + e.backLength;
+            if (e.textOffset > header.textSize ||
+                header.textSize - e.textOffset < length) {
+                cerr << "Error parsing card data\n";
+                continue;
+            }
+
+            texts.addMapped(text + e.textOffset, e.frontLength, e.backLength);
+            progress.add(e.box, e.dueRound, e.timesReviewed, e.timesCorrect);
+        }
+        texts.keepMapping(move(mapping));
+        if (compressText) texts.compress();
+        rebuildIndexes();
+        cout << "Loaded " << progress.size() << " cards\n";
+        return true;
+    }
+
+    // Reads only the progress columns of a binary deck, whose header has been
+    // checked, and leaves the text in the file behind a page cache. Returns
+    // false if any card entry is damaged, so the caller can load the deck
+    // into memory and drop those cards instead.
+    bool loadPaged(const string& filename, const BinaryDeckHeader& header) {
+        auto file = make_shared<PagedDeckText>();
+        ifstream table(filename, ios::binary);
+        if (!file->open(filename, header, textCacheBytes) || !table) return false;
+        table.seekg(sizeof(header));
+
+        texts.clear();
+        progress.clear();
+        progress.reserve(header.cardCount);
+        currentRound = header.currentRound;
+        vector<BinaryCardEntry> batch(1 << 15);
+        for (uint64_t first = 0; first < header.cardCount; first += batch.size()) {
+            size_t n = min<uint64_t>(batch.size(), header.cardCount - first);
+            table.read(reinterpret_cast<char*>(batch.data()), n * sizeof(BinaryCardEntry));
+            for (size_t k = 0; k < n && table; k++) {
+                const BinaryCardEntry& e = batch[k];
+                uint64_t length = uint64_t(e.frontLength) + e.backLength;
+                if (e.textOffset > header.textSize || header.textSize - e.textOffset < length) {
+                    table.setstate(ios::failbit);
+                    break;
+                }
+                progress.add(e.box, e.dueRound, e.timesReviewed, e.timesCorrect);
+            }
+            if (!table) {
+                cerr << "Error parsing card data, loading " << filename << " into memory\n";
+                progress.clear();
+                return false;
+            }
+        }
+        texts.adoptPaged(move(file));
+        rebuildIndexes();
+        cout << "Loaded " << progress.size() << " cards, text paged from disk\n";
+        return true;
+    }
+
+    // Maps a .fcz deck and uses its text chunks in place; only the progress
+    // columns are copied out.
+    bool loadCompressed(const string& filename) {
+        auto map = make_shared<MappedFile>();
+        if (!map->open(filename)) {
+            cerr << "No save file found, starting fresh\n";
+            return false;
+        }
+
+        CompressedDeckHeader header;
+        size_t columns = 0;
+        if (map->size() >= sizeof(header)) {
+            memcpy(&header, map->begin(), sizeof(header));
+            columns = header.cardCount * 4 * sizeof(int32_t);
+        }
+        if (map->size() < sizeof(header) || header.version != COMPRESSED_DECK_VERSION ||
+            header.cardCount > map->size() / (4 * sizeof(int32_t)) ||
+            map->size() - sizeof(header) < columns) {
+            cerr << "Unsupported or truncated deck file " << filename << "\n";
+            return false;
+        }
+
+        texts.clear();
+        progress.clear();
+        currentRound = header.currentRound;
+        const char* p = map->begin() + sizeof(header);
+        progress.readArrays(p, header.cardCount);
+        p += columns;
+        for (uint32_t c = 0; c < header.chunkCount; c++) {
+            auto chunk = TextChunk::adopt(p, map->begin() + map->size() - p, map);
+            if (!chunk || texts.size() + chunk->cardCount() > header.cardCount) {
+                cerr << "Error parsing card data\n";
+                break;
+            }
+            p += chunk->byteSize();
+            texts.adoptChunk(move(chunk));
+        }
+        progress.truncate(texts.size());
+
+        rebuildIndexes();
+        cout << "Loaded " << progress.size() << " cards\n";
+        return true;
+    }
+
+    // Reads the deck through an ifstream one line at a time. Used when the
+    // file cannot be mapped.
+    bool loadTextStream(const string& filename, DeckFormat format = DECK_TEXT) {
+        bool legacy = format == DECK_LEGACY_TEXT;
+        ifstream file(filename);
+        if (!file) {
+            cerr << "No save file found, starting fresh\n";
+            return false;
+        }
+
+        texts.clear();
+        progress.clear();
+        string line;
+
+        // First line is current round; legacy decks have no rounds
+        currentRound = 0;
+        if (!legacy) {
+            getline(file, line);
+            if (!parseInt(line, currentRound)) currentRound = 0;
+        }
+
+        // line and the scratch buffers are reused, so after the first few
+        // lines parsing a card allocates nothing beyond the text store's
+        // blocks.
+        vector<string_view> parts;
+        string unescaped;
+        while (getline(file, line)) {
+            if (parseDeckLine(line, texts, progress, parts, unescaped, legacy) ==
+                LINE_INVALID) {
+                cerr << "Error parsing card data\n";
+            }
+        }
+        if (compressText) texts.compress();
+        rebuildIndexes();
+        cout << "Loaded " << progress.size() << " cards\n";
+        return true;
+    }
+
+    // Maps the deck, splits it into newline-aligned chunks and parses them
+    // on separate threads, then appends the chunks in file order.
+    bool loadTextParallel(const string& filename, DeckFormat format = DECK_TEXT,
+                          size_t threadCount = 0) {
+        bool legacy = format == DECK_LEGACY_TEXT;
+        MappedFile map;
+        if (!map.open(filename)) return loadTextStream(filename, format);
+
+        const char* begin = map.begin();
+        const char* end = begin + map.size();
+
+        // First line is current round; legacy decks have no rounds
+        const char* body = begin;
+        currentRound = 0;
+        if (!legacy) {
+            const char* firstEnd = find(begin, end, '\n');
+            if (!parseInt(string_view(begin, firstEnd - begin), currentRound)) {
+                currentRound = 0;
+            }
+            body = firstEnd == end ? end : firstEnd + 1;
+        }
+
+        const size_t minChunk = 1 << 20;
+        if (threadCount == 0) threadCount = max(1u, thread::hardware_concurrency());
+        threadCount = max<size_t>(1, min<size_t>(threadCount, (end - body) / minChunk));
+
+        vector<const char*> bounds(1, body);
+        for (size_t t = 1; t < threadCount; t++) {
+            const char* split = body + (end - body) * t / threadCount;
+            split = max(split, bounds.back());
+            split = find(split, end, '\n');
+            bounds.push_back(split == end ? end : split + 1);
+        }
+        bounds.push_back(end);
+
+        vector<ParsedChunk> chunks(threadCount);
+        auto parseChunk = [&](size_t t) {
+            vector<string_view> parts;
+            string unescaped;
+            const char* p = bounds[t];
+            while (p < bounds[t + 1]) {
+                const char* lineEnd = find(p, bounds[t + 1], '\n');
+                if (parseDeckLine(string_view(p, lineEnd - p), chunks[t].texts,
+                                  chunks[t].progress, parts, unescaped,
+                                  legacy) == LINE_INVALID) {
+                    chunks[t].errors++;
+                }
+                p = lineEnd + 1;
+            }
+        };
+
+        vector<thread> workers;
+        for (size_t t = 1; t < threadCount; t++) workers.emplace_back(parseChunk, t);
+        parseChunk(0);
+        for (auto& worker : workers) worker.join();
+
+        size_t total = 0;
+        for (const auto& chunk : chunks) total += chunk.progress.size();
+        texts.clear();
+        progress.clear();
+        texts.reserve(total);
+        progress.reserve(total);
+        for (auto& chunk : chunks) {
+            for (size_t i = 0; i < chunk.errors; i++) {
+                cerr << "Error parsing card data\n";
+            }
+            texts.append(move(chunk.texts));
+            progress.append(chunk.progress);
+        }
+        if (compressText) texts.compress();
+        rebuildIndexes();
+        cout << "Loaded " << progress.size() << " cards\n";
+        return true;
+    }
+
+    bool load(const string& filename) {
+        METRIC_TIMER(METRIC_LOAD);
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0) METRIC_BYTES(METRIC_LOAD, st.st_size);
+        DeckFormat format = detectDeckFormat(filename);
+        if (format == DECK_BINARY) return loadBinary(filename);
+        if (format == DECK_COMPRESSED) return loadCompressed(filename);
+        return loadTextParallel(filename, format);
+    }
+
+    uint64_t textHash(size_t count) const {
+        uint64_t hash = 1469598103934665603ULL;
+        if (count > texts.size()) return 0;
+        for (size_t i = 0; i < count; i++) {
+            for (string_view part : {texts.front(i), texts.back(i)}) {
+                for (unsigned char c : part) {
+                    hash ^= c;
+                    hash *= 1099511628211ULL;
+                }
+                hash ^= 0xff;
+                hash *= 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    // Remembers where the search index is saved. It is loaded, if it still
+    // matches the deck, on the first search.
+    void attachSearchIndex(const string& path) { searchIndexPath = path; }
+
+    // Saves the search index if a search indexed cards since it was loaded.
+    // Decks that were never searched, and paged decks, have none to save.
+    void saveSearchIndex(const string& path) {
+        if (!searchIndexUsed) return;
+        updateSearchIndex();
+        if (searchIndex.getIndexedCards() == savedSearchCards) return;
+        if (searchIndex.save(path, textHash(searchIndex.getIndexedCards()))) {
+            savedSearchCards = searchIndex.getIndexedCards();
+        }
+    }
+
+    void updateSearchIndex() {
+        for (size_t i = searchIndex.getIndexedCards(); i < texts.size(); i++) {
+            searchIndex.addCard(texts.front(i), texts.back(i));
+        }
+    }
+
+    // Returns up to limit cards whose normalized front or back contains
+    // every word of the query, in deck order. Paged decks are scanned
+    // through the text cache instead of growing a trigram index over text
+    // that does not fit in memory.
+    vector<size_t> search(const string& query, size_t limit) {
+        bool indexed = !texts.getPaged();
+        if (indexed && !searchIndexUsed) {
+            searchIndexUsed = true;
+            if (!searchIndexPath.empty() &&
+                searchIndex.load(searchIndexPath, texts.size(),
+                                 [this](size_t n) { return textHash(n); })) {
+                savedSearchCards = searchIndex.getIndexedCards();
+            }
+        }
+        if (indexed) updateSearchIndex();
+
+        vector<string> words;
+        stringstream ss(query);
+        string word;
+        while (ss >> word) {
+            word = normalizeString(word);
+            if (!word.empty()) words.push_back(word);
+        }
+        vector<size_t> results;
+        if (words.empty()) return results;
+
+        vector<uint32_t> candidates;
+        bool narrowed = indexed && searchIndex.candidates(words, candidates);
+        size_t candidateCount = narrowed ? candidates.size() : texts.size();
+
+        string front, back;
+        for (size_t c = 0; c < candidateCount && results.size() < limit; c++) {
+            size_t card = narrowed ? candidates[c] : c;
+            front.resize(texts.front(card).size());
+            back.resize(texts.back(card).size());
+            front.resize(AnswerChecker::normalizeInto(texts.front(card), &front[0]));
+            back.resize(AnswerChecker::normalizeInto(texts.back(card), &back[0]));
+
+            bool matches = true;
+            for (const string& w : words) {
+                if (front.find(w) == string::npos && back.find(w) == string::npos) {
+                    matches = false;
+                    break;
+                }
+            }
+            if (matches) results.push_back(card);
+        }
+        return results;
+    }
+};
+
+// Current resident set size of the process, from /proc/self/statm.
+long residentKb() {
+    long pages = 0, resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void printMemoryUsage(const Deck& deck) {
+    DeckMemory memory = deck.memoryUsage();
+    size_t cards = max<size_t>(deck.getCardCount(), 1);
+    auto mb = [](size_t bytes) { return bytes / 1048576.0; };
+    cout << fixed << setprecision(1);
+    cout << "Scheduling state: " << mb(memory.scheduling) << " MB ("
+         << double(memory.scheduling) / cards << " bytes/card)\n";
+    cout << "Indexes: " << mb(memory.indexes) << " MB\n";
+    cout << "Card text in memory: " << mb(memory.text) << " MB\n";
+    if (deck.pagesText()) {
+        uint64_t reads = memory.cacheHits + memory.cacheMisses;
+        cout << "Text cache: " << mb(memory.textCache) << " of "
+             << mb(memory.textCacheCapacity) << " MB, "
+             << (reads > 0 ? memory.cacheHits * 100.0 / reads : 0) << "% of "
+             << reads << " page reads hit\n";
+    }
+    cout << "Process resident set: " << residentKb() / 1024.0 << " MB\n";
+}
+
+const size_t SESSION_CARDS = 20;
+const size_t PREFETCH_CARDS = 4;
+
+// Reads the text of cards about to be shown into a paged deck's cache on a
+// background thread, so paging text in never delays the next question.
+class TextPrefetcher {
+private:
+    const Deck& deck;
+    vector<size_t> pending;
+    thread worker;
+    mutex queueMutex;
+    condition_variable wake;
+    bool stopping = false;
+
+    void run() {
+        vector<size_t> cards;
+        unique_lock<mutex> lock(queueMutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (stopping) return;
+            cards.swap(pending);
+            lock.unlock();
+            for (size_t card : cards) deck.prefetchText(card);
+            cards.clear();
+            lock.lock();
+        }
+    }
+
+public:
+    explicit TextPrefetcher(const Deck& deck) : deck(deck) {}
+    TextPrefetcher(const TextPrefetcher&) = delete;
+    TextPrefetcher& operator=(const TextPrefetcher&) = delete;
+    ~TextPrefetcher() { stop(); }
+
+    void start() {
+        stop();
+        stopping = false;
+        worker = thread(&TextPrefetcher::run, this);
+    }
+
+    // Queues a card; does nothing unless the prefetcher was started.
+    void request(size_t card) {
+        if (!worker.joinable()) return;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            pending.push_back(card);
+        }
+        wake.notify_one();
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+            pending.clear();
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+class SessionManager {
+private:
+    size_t maxCards;
+    Xoshiro256 rng;
+
+    void clearInput() {
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+
+public:
+    // A session reviews at most maxCards of the due cards, the most overdue
+    // first.
+    explicit SessionManager(size_t maxCards = SESSION_CARDS, uint64_t seed = time(0))
+        : maxCards(maxCards), rng(seed) {}
+
+    void runSession(Deck& deck) {
+        deck.nextRound();
+
+        if (deck.getCardCount() == 0) {
+            cout << "\nNo cards available for review!\n";
+            return;
+        }
+
+        vector<size_t> order = deck.getDueCards(rng, maxCards);
+        if (order.empty()) {
+            cout << "\nNo cards due for review this round!\n";
+            return;
+        }
+
+        cout << "\n=== REVIEW SESSION ===\n";
+        size_t dueCount = deck.countDue();
+        if (dueCount > order.size()) {
+            cout << "Reviewing the " << order.size() << " most overdue of "
+                 << dueCount << " due cards\n";
+        }
+        cout << "Type your answer to have it graded, or press Enter to reveal the\n"
+             << "answer and then enter 'c' for correct or 'i' for incorrect\n";
+        cout << "Enter 'q' to quit\n\n";
+
+        // Paged decks read the next few cards' text while this one is shown.
+        TextPrefetcher prefetcher(deck);
+        if (deck.pagesText()) {
+            prefetcher.start();
+            for (size_t k = 1; k <= PREFETCH_CARDS && k < order.size(); k++) {
+                prefetcher.request(order[k]);
+            }
+        }
+
+        for (size_t k = 0; k < order.size(); k++) {
+            size_t index = order[k];
+            if (k + PREFETCH_CARDS + 1 < order.size()) {
+                prefetcher.request(order[k + PREFETCH_CARDS + 1]);
+            }
+            CardRecord cr = deck.getRecord(index);
+            cout << "Q: " << cr.getFront() << "\n";
+            cout << "Your answer (Enter to show it): ";
+            string input;
+            getline(cin, input);
+
+            if (input == "q") {
+                break;
+            }
+
+            if (!input.empty()) {
+                AnswerMatch match = deck.gradeTypedAnswer(input, cr.getBack());
+                cout << "\nA: " << cr.getBack() << "\n";
+                if (match.accepted) {
+                    deck.markCorrect(index);
+                    cout << (match.distance == 0 ? " Correct!" : " Close enough!")
+                         << " (Box " << cr.getBox() << ")\n\n";
+                } else {
+                    deck.markIncorrect(index);
+                    cout << " Incorrect (Box 0)\n\n";
+                }
+                continue;
+            }
+
+            cout << "\nA: " << cr.getBack() << "\n\n";
+
+            while (true) {
+                cout << "Was your answer correct? (c/i): ";
+                getline(cin, input);
+
+                if (input == "c") {
+                    deck.markCorrect(index);
+                    cout << " Marked as correct! (Box " << cr.getBox() << ")\n\n";
+                    break;
+                } else if (input == "i") {
+                    deck.markIncorrect(index);
+                    cout << " Marked as incorrect (Box 0)\n\n";
+                    break;
+                } else if (input == "q") {
+                    return;
+                } else {
+                    cout << "Invalid input. Please enter 'c' or 'i'.\n";
+                }
+            }
+        }
+        cout << "\nSession complete!\n";
+    }
+};
+
+const chrono::seconds AUTOSAVE_INTERVAL(30);
+
+// Saves a deck from a background thread whenever it has unsaved changes, at
+// most once per interval, so a long session never depends on a clean exit.
+class Autosaver {
+private:
+    Deck& deck;
+    string filename;
+    chrono::milliseconds interval;
+    DeckSnapshot snapshot;
+    thread worker;
+    mutex waitMutex;
+    condition_variable wake;
+    bool stopping = false;
+
+    void run() {
+        unique_lock<mutex> lock(waitMutex);
+        while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+            lock.unlock();
+            deck.autosave(filename, snapshot);
+            lock.lock();
+        }
+    }
+
+public:
+    Autosaver(Deck& deck, string filename, chrono::milliseconds interval)
+        : deck(deck), filename(move(filename)), interval(interval) {}
+    Autosaver(const Autosaver&) = delete;
+    Autosaver& operator=(const Autosaver&) = delete;
+    ~Autosaver() { stop(); }
+
+    void start() {
+        stop();
+        stopping = false;
+        worker = thread(&Autosaver::run, this);
+    }
+
+    // Waits for a save in progress, if any, then ends the thread.
+    void stop() {
+        {
+            lock_guard<mutex> lock(waitMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+class FlashCardApp {
+private:
+    Deck deck;
+    SessionManager sessionManager;
+    const string filename;
+    Autosaver autosaver{deck, filename, AUTOSAVE_INTERVAL};
+
+    void clearInput() {
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+
+    void resetData() {
+        cout << "\n=== RESET ALL DATA ===\n";
+        cout << "This will delete ALL cards and reset all progress!\n";
+        cout << "Are you sure? (yes/no): ";
+
+        string confirmation;
+        getline(cin, confirmation);
+
+        if (confirmation == "yes") {
+            deck.reset();
+            remove(filename.c_str());
+            remove((filename + ".trigrams").c_str());
+            remove((filename + ".times").c_str());
+            cout << "All data has been reset.\n";
+        } else {
+            cout << "Reset cancelled.\n";
+        }
+    }
+
+    void createCard() {
+        string front, back;
+        cout << "\nEnter front (question): ";
+        getline(cin, front);
+        cout << "Enter back (answer): ";
+        getline(cin, back);
+
+        deck.addCard(FlashCard(move(front), move(back)));
+    }
+
+    void showStatistics() {
+        if (deck.getCardCount() == 0) {
+            cout << "\nNo cards available!\n";
+            return;
+        }
+
+        cout << "\n=== PERFORMANCE STATISTICS ===\n";
+
+        const DeckStats& stats = deck.getStats();
+        long long totalReviews = stats.totalReviews;
+        long long totalCorrect = stats.totalCorrect;
+
+        double overallAccuracy = totalReviews > 0 ?
+            (totalCorrect * 100.0 / totalReviews) : 0;
+
+        cout << "\nOverall:\n";
+        cout << "Total reviews: " << totalReviews << "\n";
+        cout << "Correct answers: " << totalCorrect << "\n";
+        cout << "Accuracy: " << fixed << setprecision(1)
+             << overallAccuracy << "%\n";
+        if (deck.usesWallClock()) {
+            cout << "Due now: " << deck.countDue() << "\n";
+            cout << "Due within 24 hours: " << deck.countDueWithin(MINUTES_PER_DAY) << "\n";
+        }
+
+        cout << "\nMemory:\n";
+        printMemoryUsage(deck);
+
+        cout << "\nCard Details:\n" << flush;
+        const int width = 20;
+        BufferedWriter out(STDOUT_FILENO);
+        for (size_t i = 0; i < deck.getCardCount(); i++) {
+            CardRecord cr = deck.getRecord(i);
+            int reviewed = cr.getTimesReviewed();
+            int filled =
+                reviewed > 0 ? clamp(width * cr.getTimesCorrect() / reviewed, 0, width) : 0;
+            out.write("\nCard #");
+            out.writeInt(i + 1);
+            out.write(" (Box ");
+            out.writeInt(cr.getBox());
+            out.write(")\nQ: ");
+            out.write(cr.getFront());
+            out.write("\n[");
+            out.writeRepeated('=', filled);
+            out.writeRepeated('-', width - filled);
+            out.write("]  ");
+            out.writeFixed(cr.getAccuracy(), 1);
+            out.write("%\nReviews: ");
+            out.writeInt(reviewed);
+            out.write(" | Correct: ");
+            out.writeInt(cr.getTimesCorrect());
+            out.put('\n');
+        }
+    }
+
+    void searchCards() {
+        cout << "\nSearch for: ";
+        string query;
+        getline(cin, query);
+
+        const size_t maxResults = 20;
+        auto start = chrono::steady_clock::now();
+        vector<size_t> results = deck.search(query, maxResults + 1);
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+        if (results.empty()) {
+            cout << "No matching cards.\n";
+            return;
+        }
+        for (size_t i = 0; i < results.size() && i < maxResults; i++) {
+            CardRecord cr = deck.getRecord(results[i]);
+            cout << "\nCard #" << (results[i] + 1) << " (Box " << cr.getBox() << ")\n";
+            cout << "Q: " << cr.getFront() << "\n";
+            cout << "A: " << cr.getBack() << "\n";
+        }
+        if (results.size() > maxResults) {
+            cout << "\nShowing the first " << maxResults << " matches.\n";
+        }
+        cout << "(" << fixed << setprecision(2) << elapsed.count() << " ms)\n";
+    }
+
+    void showHeatmap() {
+        if (deck.getCardCount() == 0) {
+            cout << "\nNo cards available!\n";
+            return;
+        }
+
+        const DeckStats stats = deck.getStats();
+        const auto& boxCounts = stats.boxCounts;
+
+        cout << "\n=== DIFFICULTY HEATMAP ===\n";
+        cout << "Box 0: Easiest, Box " << MAX_BOX << ": Hardest\n\n";
+
+        const int max_bar_length = 50;
+        size_t max_count = 0;
+        for (size_t count : boxCounts) {
+            if (count > max_count) max_count = count;
+        }
+
+        for (int i = 0; i <= MAX_BOX; i++) {
+            int bar_length = max_count > 0 ?
+                (boxCounts[i] * max_bar_length / max_count) : 0;
+            cout << "[" << i << "] " << string(bar_length, '#')
+                 << " " << boxCounts[i] << " cards\n";
+        }
+    }
+
+public:
+    // A non-zero textCacheBytes pages a binary deck's text in from disk
+    // instead of loading it.
+    explicit FlashCardApp(string deckFile = "spaced_cards.txt", size_t textCacheBytes = 0)
+        : filename(move(deckFile)) {
+        deck.setTextCacheBytes(textCacheBytes);
+        deck.load(filename);
+        deck.loadDueTimes(filename + ".times");
+        deck.attachJournal(filename + ".journal");
+        deck.attachSearchIndex(filename + ".trigrams");
+        autosaver.start();
+    }
+
+    ~FlashCardApp() {
+        // Every change is already journaled, so exit never waits for a full
+        // save; the autosaver folds the journal in on the next run.
+        autosaver.stop();
+        deck.saveSearchIndex(filename + ".trigrams");
+    }
+
+    void run() {
+        while (true) {
+            cout << "\n===== FLASHCARDS =====\n";
+            cout << "Total Cards: " << deck.getCardCount();
+            cout << "\n\n1. Create Card\n";
+            cout << "2. Review Session\n";
+            cout << "3. Show Statistics\n";
+            cout << "4. Show Heatmap\n";
             cout << "5. Reset All Data\n";
-            cout << "6. Exit\n";
-            cout << "Choose (1-6): ";
+            cout << "6. Search Cards\n";
+            cout << "7. Show Metrics\n";
+            cout << "8. Exit\n";
+            cout << "Choose (1-8): ";
+
+            int choice;
+            cin >> choice;
+            clearInput();
+
+            switch (choice) {
+                case 1: createCard(); break;
+                case 2: sessionManager.runSession(deck); break;
+                case 3: showStatistics(); break;
+                case 4: showHeatmap(); break;
+                case 5: resetData(); break;
+                case 6: searchCards(); break;
+                case 7: dumpMetrics(cout); break;
+                case 8: return;
+                default: cout << "Invalid choice!\n";
+            }
+        }
+    }
+};
+
+struct SimulationConfig {
+    size_t learners = 64;
+    size_t cards = 10000;
+    int rounds = 1000;
+    size_t newPerRound = 50;
+    double firstRecall = 0.5;
+    double stability = 2.0;
+    double growth = 2.2;
+    array<int, MAX_BOX + 1> intervals = {1, 1, 2, 4, 8, 16};
+    size_t threads = 0;
+    uint64_t seed = 1;
+};
+
+// Simulates many learners studying the same deck with the app's Leitner
+// transitions (ProgressTable and DueIndex). A learner recalls a card they
+// have not reviewed yet with probability firstRecall; afterwards recall
+// decays as exp(-elapsed / (stability * growth^box)), elapsed being the
+// rounds since its last review. Learners are split across threads, each
+// with its own RNG and counters.
+class LeitnerSimulator {
+private:
+    SimulationConfig config;
+    int sampleEvery;
+    vector<long long> reviews;
+    vector<long long> recalled;
+    vector<double> retention;
+
+    struct ThreadResult {
+        vector<long long> reviews;
+        vector<long long> recalled;
+        vector<double> retention;
+    };
+
+    double recallProbability(const ProgressTable& progress,
+                             const vector<int>& lastReview, size_t card,
+                             int round) const {
+        if (progress.getTimesReviewed(card) == 0) return config.firstRecall;
+        double strength = config.stability * pow(config.growth, progress.getBox(card));
+        return exp(-(round - lastReview[card]) / strength);
+    }
+
+    void simulateLearner(mt19937_64& rng, ThreadResult& result) const {
+        ProgressTable progress;
+        DueIndex dueIndex;
+        vector<int> lastReview;
+        vector<size_t> due;
+        progress.setIntervals(config.intervals);
+        progress.reserve(config.cards);
+        lastReview.reserve(config.cards);
+        uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        for (int round = 1; round <= config.rounds; round++) {
+            for (size_t n = 0; n < config.newPerRound && progress.size() < config.cards; n++) {
+                progress.add(0, 0, 0, 0);
+                lastReview.push_back(0);
+                dueIndex.insert(progress.size() - 1, 0);
+            }
+
+            due.clear();
+            dueIndex.collectDue(round, due);
+            for (size_t card : due) {
+                bool remembered = uniform(rng) <
+                    recallProbability(progress, lastReview, card, round);
+                int oldDue = progress.getDueRound(card);
+                if (remembered) progress.markCorrect(card, round);
+                else progress.markIncorrect(card, round);
+                dueIndex.move(card, oldDue, progress.getDueRound(card));
+                lastReview[card] = round;
+                result.reviews[round]++;
+                result.recalled[round] += remembered;
+            }
+
+            if (round % sampleEvery == 0 && progress.size() > 0) {
+                double total = 0;
+                for (size_t card = 0; card < progress.size(); card++) {
+                    total += recallProbability(progress, lastReview, card, round);
+                }
+                result.retention[round / sampleEvery] += total / progress.size();
+            }
+        }
+    }
+
+public:
+    explicit LeitnerSimulator(const SimulationConfig& c)
+        : config(c), sampleEvery(max(1, c.rounds / 20)) {}
+
+    void run() {
+        size_t threadCount = config.threads ? config.threads
+                                            : max(1u, thread::hardware_concurrency());
+        threadCount = min(threadCount, config.learners);
+        vector<ThreadResult> results(threadCount);
+
+        auto worker = [&](size_t t) {
+            ThreadResult& result = results[t];
+            result.reviews.assign(config.rounds + 1, 0);
+            result.recalled.assign(config.rounds + 1, 0);
+            result.retention.assign(config.rounds / sampleEvery + 1, 0);
+            mt19937_64 rng(config.seed * 1000003 + t);
+            for (size_t learner = t; learner < config.learners; learner += threadCount) {
+                simulateLearner(rng, result);
+            }
+        };
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 1; t < threadCount; t++) workers.emplace_back(worker, t);
+        worker(0);
+        for (auto& w : workers) w.join();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        reviews.assign(config.rounds + 1, 0);
+        recalled.assign(config.rounds + 1, 0);
+        retention.assign(config.rounds / sampleEvery + 1, 0);
+        for (const auto& result : results) {
+            for (int r = 0; r <= config.rounds; r++) {
+                reviews[r] += result.reviews[r];
+                recalled[r] += result.recalled[r];
+            }
+            for (size_t i = 0; i < retention.size(); i++) {
+                retention[i] += result.retention[i];
+            }
+        }
+        report(elapsed.count(), threadCount);
+    }
+
+    void report(double seconds, size_t threadCount) const {
+        cout << "Simulated " << config.learners << " learners x " << config.cards
+             << " cards x " << config.rounds << " rounds on " << threadCount
+             << " threads in " << fixed << setprecision(2) << seconds << " s\n";
+        cout << "Intervals:";
+        for (int box = 0; box <= MAX_BOX; box++) cout << " " << config.intervals[box];
+        cout << "\n\n   rounds   reviews/round   recall at review   retention\n";
+
+        long long totalReviews = 0, totalRecalled = 0;
+        for (int from = 1; from <= config.rounds; from += sampleEvery) {
+            int to = min(config.rounds, from + sampleEvery - 1);
+            long long windowReviews = 0, windowRecalled = 0;
+            for (int r = from; r <= to; r++) {
+                windowReviews += reviews[r];
+                windowRecalled += recalled[r];
+            }
+            totalReviews += windowReviews;
+            totalRecalled += windowRecalled;
+
+            double perRound = double(windowReviews) / config.learners / (to - from + 1);
+            cout << setw(5) << from << "-" << left << setw(5) << to << right
+                 << setw(14) << setprecision(1) << perRound
+                 << setw(18) << setprecision(1)
+                 << (windowReviews ? windowRecalled * 100.0 / windowReviews : 0) << "%";
+            if (to % sampleEvery == 0) {
+                cout << setw(11) << retention[to / sampleEvery] * 100.0 / config.learners << "%";
+            }
+            cout << "\n";
+        }
+        cout << "\nAverage reviews per learner per round: " << setprecision(1)
+             << double(totalReviews) / config.learners / config.rounds << "\n";
+        cout << "Recall at review: "
+             << (totalReviews ? totalRecalled * 100.0 / totalReviews : 0) << "%\n";
+    }
+};
+
+// Reads key=value options for --simulate. Counts are parsed like other
+// command-line numbers and kept within generous bounds, so a typo cannot
+// ask for billions of learners or threads.
+bool parseSimulationConfig(const vector<string>& args, SimulationConfig& config) {
+    auto count = [](const string& value, size_t low, size_t high, auto& field) {
+        size_t number;
+        if (!parseCount(value, number) || number < low || number > high) return false;
+        field = number;
+        return true;
+    };
+    auto real = [](const string& value, double low, double high, double& field) {
+        char* end;
+        double number = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !(number >= low && number <= high)) {
+            return false;
+        }
+        field = number;
+        return true;
+    };
+    for (size_t i = 1; i < args.size(); i++) {
+        size_t eq = args[i].find('=');
+        if (eq == string::npos) return false;
+        string key = args[i].substr(0, eq);
+        string value = args[i].substr(eq + 1);
+        bool valid;
+        if (key == "learners") valid = count(value, 1, 1000000, config.learners);
+        else if (key == "cards") valid = count(value, 1, 100000000, config.cards);
+        else if (key == "rounds") valid = count(value, 1, 1000000, config.rounds);
+        else if (key == "new") valid = count(value, 0, 100000000, config.newPerRound);
+        else if (key == "first") valid = real(value, 0, 1, config.firstRecall);
+        else if (key == "stability") valid = real(value, 1e-6, 1e6, config.stability);
+        else if (key == "growth") valid = real(value, 1e-6, 1e6, config.growth);
+        else if (key == "threads") valid = count(value, 0, 1024, config.threads);
+        else if (key == "seed") valid = count(value, 0, SIZE_MAX, config.seed);
+        else if (key == "intervals") {
+            stringstream ss(value);
+            string part;
+            valid = true;
+            for (int box = 0; box <= MAX_BOX && valid && getline(ss, part, ','); box++) {
+                valid = count(part, 1, 1000000, config.intervals[box]);
+            }
+        } else {
+            valid = false;
+        }
+        if (!valid) return false;
+    }
+    return true;
+}
+
+// Silences cout while a timed operation runs, so Deck's status messages
+// don't end up in the measurement.
+class QuietOutput {
+private:
+    // Drops everything without failing the stream, so several threads can
+    // print through it at once.
+    struct Discard : streambuf {
+        int overflow(int c) override { return traits_type::not_eof(c); }
+        streamsize xsputn(const char*, streamsize n) override { return n; }
+    } discard;
+    streambuf* saved;
+
+public:
+    QuietOutput() : saved(cout.rdbuf(&discard)) {}
+    ~QuietOutput() { cout.rdbuf(saved); }
+};
+
+long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+size_t fileSize(const string& filename) {
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int dedupDeck(const string& input, const string& output, bool includeBack) {
+    Deck deck;
+    deck.setDuplicateKeyIncludesBack(includeBack);
+    auto start = chrono::steady_clock::now();
+    if (!deck.load(input)) return 1;
+    deck.removeDuplicates();
+    bool saved = deck.save(output);
+    cout << "Done in " << fixed << setprecision(1) << elapsedMs(start) << " ms\n";
+    return saved ? 0 : 1;
+}
+
+int convertDeck(const string& input, const string& output) {
+    Deck deck;
+    if (!deck.load(input)) return 1;
+    return deck.save(output) ? 0 : 1;
+}
+
+bool equalsIgnoringCase(string_view a, string_view b) {
+    return a.size() == b.size() &&
+           equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return tolower(static_cast<unsigned char>(x)) ==
+                      tolower(static_cast<unsigned char>(y));
+           });
+}
+
+// Adds the front,back records of a CSV or TSV file to a deck. Extra columns
+// are ignored, and a first record of "front" and "back" is taken as a header.
+int importCardFile(const string& deckFile, const string& input, const string& format) {
+    bool tsv = format.empty() ? hasSuffix(input, ".tsv") || hasSuffix(input, ".tab")
+                              : format == "tsv";
+    int fd = input == "-" ? STDIN_FILENO : ::open(input.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Cannot open " << input << "\n";
+        return 1;
+    }
+
+    Deck deck;
+    {
+        QuietOutput quiet;
+        deck.load(deckFile);
+    }
+    deck.loadDueTimes(deckFile + ".times");
+    deck.attachJournal(deckFile + ".journal");
+
+    auto start = chrono::steady_clock::now();
+    DelimitedReader reader(fd, tsv ? '\t' : ',');
+    struct stat st;
+    size_t expected = fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+                      ? reader.estimateRecords(st.st_size) : 0;
+    vector<string> fields;
+    size_t count = 0, records = 0;
+    size_t added = deck.importCards(expected, [&](string_view& front, string_view& back) {
+        while (reader.next(fields, count)) {
+            if (records++ == 0 && count >= 2 && equalsIgnoringCase(fields[0], "front") &&
+                equalsIgnoringCase(fields[1], "back")) {
+                records = 0;
+                continue;
+            }
+            front = count >= 1 ? string_view(fields[0]) : string_view();
+            back = count >= 2 ? string_view(fields[1]) : string_view();
+            return true;
+        }
+        return false;
+    });
+    if (fd != STDIN_FILENO) ::close(fd);
+
+    cout << "Imported " << added << " of " << records << " cards ("
+         << records - added << " empty or duplicate) in " << fixed
+         << setprecision(1) << elapsedMs(start) << " ms\n";
+    return deck.checkpoint(deckFile) ? 0 : 1;
+}
+
+// Converts every deck in inputDir, of any generation, to format ("txt",
+// "bin" or "fcz") in outputDir, keeping the file names up to the extension.
+// Decks are converted on one thread per core, each written through a
+// temporary file; files that are not decks are skipped. Nothing is converted
+// if two decks would be written to the same file.
+int migrateDecks(const string& inputDir, const string& outputDir, const string& format) {
+    DIR* dir = opendir(inputDir.c_str());
+    if (!dir) {
+        cerr << "Cannot open " << inputDir << "\n";
+        return 1;
+    }
+    vector<string> names;
+    while (dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        struct stat st;
+        if (name[0] != '.' && stat((inputDir + "/" + name).c_str(), &st) == 0 &&
+            S_ISREG(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    if (mkdir(outputDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Cannot create " << outputDir << "\n";
+        return 1;
+    }
+
+    struct Migration {
+        DeckFormat format = DECK_UNKNOWN;
+        size_t cards = 0;
+        bool saved = false;
+        string output;
+    };
+    vector<Migration> migrations(names.size());
+    map<string, size_t> outputs;
+    bool collided = false;
+    for (size_t i = 0; i < names.size(); i++) {
+        Migration& m = migrations[i];
+        m.format = detectDeckFormat(inputDir + "/" + names[i]);
+        if (m.format == DECK_MISSING || m.format == DECK_UNKNOWN) continue;
+        size_t dot = names[i].rfind('.');
+        m.output = names[i].substr(0, dot == 0 ? string::npos : dot) + "." + format;
+        auto [first, added] = outputs.emplace(m.output, i);
+        if (!added) {
+            cerr << names[first->second] << " and " << names[i]
+                 << " would both be written to " << m.output << "\n";
+            collided = true;
+        }
+    }
+    if (collided) {
+        cerr << "Nothing migrated; rename the colliding decks first\n";
+        return 1;
+    }
+
+    atomic<size_t> nextDeck{0};
+    auto migrate = [&]() {
+        for (size_t i; (i = nextDeck++) < names.size();) {
+            Migration& m = migrations[i];
+            if (m.format == DECK_MISSING || m.format == DECK_UNKNOWN) continue;
+            string input = inputDir + "/" + names[i];
+            Deck deck;
+            m.saved = deck.load(input) && deck.save(outputDir + "/" + m.output);
+            m.cards = deck.getCardCount();
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    {
+        QuietOutput quiet;
+        size_t threadCount = min<size_t>(max(1u, thread::hardware_concurrency()),
+                                         max<size_t>(1, names.size()));
+        vector<thread> workers;
+        for (size_t t = 1; t < threadCount; t++) workers.emplace_back(migrate);
+        migrate();
+        for (auto& worker : workers) worker.join();
+    }
+    double ms = elapsedMs(start);
+
+    size_t migrated = 0, cards = 0, failed = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        const Migration& m = migrations[i];
+        cout << names[i] << ": ";
+        if (m.format == DECK_MISSING || m.format == DECK_UNKNOWN) {
+            cout << "skipped, not a deck\n";
+        } else if (!m.saved) {
+            cout << deckFormatName(m.format) << ", failed\n";
+            failed++;
+        } else {
+            cout << deckFormatName(m.format) << ", " << m.cards << " cards -> "
+                 << m.output << "\n";
+            migrated++;
+            cards += m.cards;
+        }
+    }
+    cout << "Migrated " << migrated << " decks (" << cards << " cards) in " << fixed
+         << setprecision(1) << ms << " ms\n";
+    return failed == 0 ? 0 : 1;
+}
+
+// Moves a deck from round to wall-clock scheduling: each card's due round
+// becomes a due time and the times are saved to <deck>.times, which the app
+// picks up from then on. Deleting that file goes back to rounds.
+int scheduleByWallClock(const string& deckFile) {
+    Deck deck;
+    {
+        QuietOutput quiet;
+        if (!deck.load(deckFile)) return 1;
+    }
+    deck.loadDueTimes(deckFile + ".times");
+    deck.attachJournal(deckFile + ".journal");
+    deck.useWallClock();
+    if (!deck.checkpoint(deckFile)) return 1;
+    cout << deck.countDue() << " cards due now, " << deck.countDueWithin(MINUTES_PER_DAY)
+         << " within 24 hours\n";
+    return 0;
+}
+
+// Loads a deck, with its text paged through a cache of cacheMB megabytes
+// when non-zero, and reports what it holds in memory.
+int reportMemory(const string& deckFile, size_t cacheMB) {
+    Deck deck;
+    deck.setTextCacheBytes(cacheMB << 20);
+    {
+        QuietOutput quiet;
+        if (!deck.load(deckFile)) return 1;
+    }
+    deck.loadDueTimes(deckFile + ".times");
+    cout << deck.getCardCount() << " cards"
+         << (deck.pagesText() ? ", text paged from disk\n" : "\n");
+    printMemoryUsage(deck);
+    return 0;
+}
+
+// Streams one line of per-card statistics per card, as CSV with a header row
+// or as JSON Lines.
+void writeStatsExport(const Deck& deck, BufferedWriter& out, bool json) {
+    if (!json) out.write("card,front,back,box,due_round,reviewed,correct,accuracy\n");
+    for (size_t i = 0; i < deck.getCardCount(); i++) {
+        CardRecord cr = deck.getRecord(i);
+        if (json) {
+            out.write("{\"card\":");
+            out.writeInt(i + 1);
+            out.write(",\"front\":");
+            out.writeJsonString(cr.getFront());
+            out.write(",\"back\":");
+            out.writeJsonString(cr.getBack());
+            out.write(",\"box\":");
+            out.writeInt(cr.getBox());
+            out.write(",\"due_round\":");
+            out.writeInt(cr.getDueRound());
+            out.write(",\"reviewed\":");
+            out.writeInt(cr.getTimesReviewed());
+            out.write(",\"correct\":");
+            out.writeInt(cr.getTimesCorrect());
+            out.write(",\"accuracy\":");
+            out.writeFixed(cr.getAccuracy(), 1);
+            out.write("}\n");
+        } else {
+            out.writeInt(i + 1);
+            out.put(',');
+            out.writeCsvField(cr.getFront());
+            out.put(',');
+            out.writeCsvField(cr.getBack());
+            out.put(',');
+            out.writeInt(cr.getBox());
+            out.put(',');
+            out.writeInt(cr.getDueRound());
+            out.put(',');
+            out.writeInt(cr.getTimesReviewed());
+            out.put(',');
+            out.writeInt(cr.getTimesCorrect());
+            out.put(',');
+            out.writeFixed(cr.getAccuracy(), 1);
+            out.put('\n');
+        }
+    }
+}
+
+// Exports per-card statistics to a file, or to stdout when the output is "-".
+// The format is JSON Lines for .jsonl/.json outputs or when asked for, CSV
+// otherwise.
+int exportStats(const string& deckFile, const string& output, const string& format) {
+    Deck deck;
+    {
+        QuietOutput quiet;
+        if (!deck.load(deckFile)) {
+            cerr << "Cannot load " << deckFile << "\n";
+            return 1;
+        }
+    }
+    bool json = format.empty() ? hasSuffix(output, ".jsonl") || hasSuffix(output, ".json")
+                               : format == "jsonl" || format == "json";
+
+    int fd = STDOUT_FILENO;
+    if (output != "-") {
+        fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Cannot open " << output << "\n";
+            return 1;
+        }
+    }
+    auto start = chrono::steady_clock::now();
+    bool written;
+    {
+        BufferedWriter out(fd);
+        writeStatsExport(deck, out, json);
+        written = out.flush();
+    }
+    if (fd != STDOUT_FILENO && ::close(fd) != 0) written = false;
+    if (!written) {
+        cerr << "Error writing " << output << "\n";
+        return 1;
+    }
+    if (output != "-") {
+        double ms = elapsedMs(start);
+        cerr << "Exported " << deck.getCardCount() << " cards in " << fixed
+             << setprecision(1) << ms << " ms ("
+             << fileSize(output) / 1048576.0 / max(ms / 1000, 1e-9) << " MB/s)\n";
+    }
+    return 0;
+}
+
+// Grades a file of "card number|typed answer" lines against a deck and
+// prints "card number|1 or 0|edit distance" for each one.
+int gradeAnswers(const string& deckFile, const string& answerFile) {
+    Deck deck;
+    {
+        QuietOutput quiet;
+        if (!deck.load(deckFile)) {
+            cerr << "Cannot load " << deckFile << "\n";
+            return 1;
+        }
+    }
+    ifstream answers(answerFile);
+    if (!answers) {
+        cerr << "Cannot open " << answerFile << "\n";
+        return 1;
+    }
+
+    string line;
+    string out;
+    size_t graded = 0, accepted = 0;
+    while (getline(answers, line)) {
+        size_t bar = line.find('|');
+        int number;
+        if (bar == string::npos || !parseInt(string_view(line).substr(0, bar), number) ||
+            number < 1 || size_t(number) > deck.getCardCount()) {
+            continue;
+        }
+        string_view typed = string_view(line).substr(bar + 1);
+        AnswerMatch match =
+            deck.gradeTypedAnswer(typed, deck.getRecord(number - 1).getBack());
+        out.append(line, 0, bar);
+        out += match.accepted ? "|1|" : "|0|";
+        out += to_string(match.distance);
+        out += '\n';
+        if (out.size() > (1 << 16)) {
+            cout << out;
+            out.clear();
+        }
+        graded++;
+        accepted += match.accepted;
+    }
+    cout << out;
+    cerr << accepted << " of " << graded << " answers accepted\n";
+    return 0;
+}
+
+// Applies a log of "card number outcome round" lines (fields separated by
+// spaces, tabs or '|'; outcome c/1 or i/0) to a deck in batches, journaling
+// them like interactive grades.
+int replayGrades(const string& deckFile, const string& eventFile) {
+    Deck deck;
+    {
+        QuietOutput quiet;
+        deck.load(deckFile);
+    }
+    deck.loadDueTimes(deckFile + ".times");
+    deck.attachJournal(deckFile + ".journal");
+
+    MappedFile map;
+    if (!map.open(eventFile)) {
+        cerr << "Cannot open " << eventFile << "\n";
+        return 1;
+    }
+
+    const size_t batchSize = 1 << 16;
+    vector<GradeEvent> batch;
+    batch.reserve(batchSize);
+    size_t total = 0, applied = 0;
+
+    auto start = chrono::steady_clock::now();
+    const char* p = map.begin();
+    const char* end = p + map.size();
+    while (p < end) {
+        const char* lineEnd = find(p, end, '\n');
+        string_view fields[3];
+        size_t count = 0;
+        const char* q = p;
+        while (q < lineEnd && count < 3) {
+            while (q < lineEnd && (*q == ' ' || *q == '\t' || *q == '|' || *q == '\r')) q++;
+            const char* fieldStart = q;
+            while (q < lineEnd && *q != ' ' && *q != '\t' && *q != '|' && *q != '\r') q++;
+            if (q > fieldStart) fields[count++] = string_view(fieldStart, q - fieldStart);
+        }
+        p = lineEnd + 1;
+        if (count == 0) continue;
+        total++;
+
+        int number, round;
+        char outcome = count == 3 ? fields[1][0] : 0;
+        if (count != 3 || !parseInt(fields[0], number) || number < 1 ||
+            !parseInt(fields[2], round) ||
+            (outcome != 'c' && outcome != 'i' && outcome != '1' && outcome != '0')) {
+            continue;
+        }
+        batch.push_back({uint32_t(number - 1), outcome == 'c' || outcome == '1', round});
+        if (batch.size() == batchSize) {
+            applied += deck.applyGrades(batch);
+            batch.clear();
+        }
+    }
+    applied += deck.applyGrades(batch);
+    double ms = elapsedMs(start);
+
+    cout << "Applied " << applied << " of " << total << " events in " << fixed
+         << setprecision(1) << ms << " ms (" << setprecision(2)
+         << applied / (ms / 1000) / 1e6 << " M events/s)\n";
+    if (deck.needsCompaction()) deck.checkpoint(deckFile);
+    return 0;
+}
+
+// Review protocol: one request per line, one reply line each, starting with
+// "OK" or "ERR". Card numbers start at 1.
+//   DUE <limit>        OK <count> <card>...  (up to limit due cards)
+//   CARD <card>        OK <front>|<back>  (escaped as in the text format)
+//   CORRECT <card>     OK <new box>
+//   INCORRECT <card>   OK <new box>
+//   NEXT               OK <new round>
+//   STATS              OK <cards> <reviews> <correct> <box 0 count>...
+//   QUIT
+// An address that is a number is a TCP port on 127.0.0.1; anything else is
+// the path of a Unix socket. A client sending a line longer than
+// MAX_REQUEST_LINE gets "ERR line too long" and is disconnected.
+const size_t MAX_REQUEST_LINE = 4096;
+
+volatile sig_atomic_t serverStopping = 0;
+
+void stopServer(int) { serverStopping = 1; }
+
+bool isPortNumber(const string& address) {
+    return !address.empty() &&
+           all_of(address.begin(), address.end(),
+                  [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+// Reads a TCP port from an address that isPortNumber accepted.
+bool parsePort(const string& address, uint16_t& port) {
+    int number;
+    if (!parseInt(address, number) || number < 1 || number > 65535) return false;
+    port = number;
+    return true;
+}
+
+int listenOn(const string& address) {
+    int fd;
+    uint16_t port;
+    if (isPortNumber(address)) {
+        if (!parsePort(address, port)) return -1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (fd < 0 || address.size() >= sizeof(addr.sun_path)) {
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        unlink(address.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 128) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectTo(const string& address) {
+    int fd;
+    int result;
+    uint16_t port;
+    if (isPortNumber(address)) {
+        if (!parsePort(address, port)) return -1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        result = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        result = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+    if (result != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendAll(int fd, string_view data) {
+    while (!data.empty()) {
+        ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+// Serves one shared deck to any number of local clients, one thread per
+// connection. Grades and due queries go straight to the deck, which locks
+// only the shard of the card involved; the autosaver keeps it on disk.
+class ReviewServer {
+private:
+    Deck& deck;
+    int listenFd = -1;
+    mutex clientsMutex;
+    vector<int> clientFds;
+    vector<thread::id> finished;
+    vector<thread> workers;
+    size_t connectionCount = 0;
+    atomic<size_t> requestCount{0};
+
+    bool parseCard(string_view arg, size_t& card) const {
+        int number;
+        if (!parseInt(arg, number) || number < 1 || size_t(number) > deck.getCardCount()) {
+            return false;
+        }
+        card = number - 1;
+        return true;
+    }
+
+    void handle(string_view line, string& out, Xoshiro256& rng) {
+        size_t space = line.find(' ');
+        string_view command = line.substr(0, space);
+        string_view arg = space == string_view::npos ? "" : trimView(line.substr(space + 1));
+        size_t card;
+        int limit;
+
+        if (command == "DUE" && parseInt(arg, limit) && limit >= 0) {
+            vector<size_t> due = deck.getDueCards(rng, limit);
+            size_t count = due.size();
+            out += "OK ";
+            out += to_string(count);
+            for (size_t i = 0; i < count; i++) {
+                out += ' ';
+                out += to_string(due[i] + 1);
+            }
+        } else if (command == "CARD" && parseCard(arg, card)) {
+            CardRecord cr = deck.getRecord(card);
+            auto appendText = [&](string_view text) { out += text; };
+            out += "OK ";
+            escapeDeckText(cr.getFront(), appendText);
+            out += '|';
+            escapeDeckText(cr.getBack(), appendText);
+        } else if (command == "CORRECT" && parseCard(arg, card)) {
+            out += "OK " + to_string(deck.markCorrect(card));
+        } else if (command == "INCORRECT" && parseCard(arg, card)) {
+            out += "OK " + to_string(deck.markIncorrect(card));
+        } else if (command == "NEXT") {
+            out += "OK " + to_string(deck.nextRound());
+        } else if (command == "STATS") {
+            DeckStats stats = deck.getStats();
+            out += "OK " + to_string(deck.getCardCount()) + " " +
+                   to_string(stats.totalReviews) + " " + to_string(stats.totalCorrect);
+            for (size_t count : stats.boxCounts) out += " " + to_string(count);
+        } else {
+            out += "ERR bad request";
+        }
+        out += '\n';
+        requestCount.fetch_add(1, memory_order_relaxed);
+    }
+
+    void serveClient(int fd) {
+        Xoshiro256 rng(chrono::steady_clock::now().time_since_epoch().count() ^ fd);
+        string input, output;
+        char buffer[1 << 16];
+        bool open = true;
+        while (open) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            input.append(buffer, n);
+
+            // Answer every complete line received so far in one write, so
+            // pipelined requests cost one syscall per batch.
+            size_t start = 0, newline;
+            while ((newline = input.find('\n', start)) != string::npos) {
+                string_view line = trimView(string_view(input).substr(start, newline - start));
+                start = newline + 1;
+                if (line == "QUIT") {
+                    open = false;
+                    break;
+                }
+                if (!line.empty()) handle(line, output, rng);
+            }
+            input.erase(0, start);
+            if (input.size() > MAX_REQUEST_LINE) {
+                output += "ERR line too long\n";
+                open = false;
+            }
+            if (!sendAll(fd, output)) break;
+            output.clear();
+        }
+
+        lock_guard<mutex> lock(clientsMutex);
+        clientFds.erase(find(clientFds.begin(), clientFds.end(), fd));
+        finished.push_back(this_thread::get_id());
+        ::close(fd);
+    }
+
+    // Joins the handlers whose clients have disconnected, so a long-running
+    // server holds one thread per open connection rather than per accept.
+    void reapWorkers() {
+        vector<thread::id> done;
+        {
+            lock_guard<mutex> lock(clientsMutex);
+            done.swap(finished);
+        }
+        for (thread::id id : done) {
+            auto worker = find_if(workers.begin(), workers.end(),
+                                  [id](const thread& t) { return t.get_id() == id; });
+            worker->join();
+            *worker = move(workers.back());
+            workers.pop_back();
+        }
+    }
+
+public:
+    explicit ReviewServer(Deck& deck) : deck(deck) {}
+    ReviewServer(const ReviewServer&) = delete;
+    ReviewServer& operator=(const ReviewServer&) = delete;
+    ~ReviewServer() { if (listenFd >= 0) ::close(listenFd); }
+
+    bool open(const string& address) {
+        listenFd = listenOn(address);
+        if (listenFd < 0) {
+            cerr << "Cannot listen on " << address << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Accepts clients until SIGINT or SIGTERM, then disconnects them all.
+    void run() {
+        struct sigaction action = {};
+        action.sa_handler = stopServer;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        while (!serverStopping) {
+            reapWorkers();
+            pollfd pfd = {listenFd, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0) continue;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            lock_guard<mutex> lock(clientsMutex);
+            clientFds.push_back(fd);
+            workers.emplace_back(&ReviewServer::serveClient, this, fd);
+            connectionCount++;
+        }
+
+        {
+            lock_guard<mutex> lock(clientsMutex);
+            for (int fd : clientFds) shutdown(fd, SHUT_RDWR);
+        }
+        for (thread& worker : workers) worker.join();
+        cout << "Served " << requestCount.load() << " requests from "
+             << connectionCount << " connections\n";
+    }
+};
+
+int serveDeck(const string& deckFile, const string& address) {
+    Deck deck;
+    deck.load(deckFile);
+    deck.loadDueTimes(deckFile + ".times");
+    deck.attachJournal(deckFile + ".journal");
+    ReviewServer server(deck);
+    if (!server.open(address)) return 1;
+
+    Autosaver autosaver(deck, deckFile, AUTOSAVE_INTERVAL);
+    autosaver.start();
+    cout << "Serving " << deckFile << " on " << address << "\n" << flush;
+    server.run();
+    autosaver.stop();
+    if (!isPortNumber(address)) unlink(address.c_str());
+    return 0;
+}
+
+// Reads one reply line, keeping any bytes after it for the next call.
+bool readReply(int fd, string& buffer, string& reply) {
+    size_t newline;
+    while ((newline = buffer.find('\n')) == string::npos) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    reply.assign(buffer, 0, newline);
+    buffer.erase(0, newline + 1);
+    return true;
+}
+
+void printLatencies(const char* name, vector<uint32_t>& ns) {
+    if (ns.empty()) return;
+    sort(ns.begin(), ns.end());
+    auto at = [&ns](double q) { return ns[min(ns.size() - 1, size_t(q * ns.size()))] / 1000.0; };
+    cout << left << setw(8) << name << right << setw(10) << ns.size() << " requests"
+         << fixed << setprecision(1) << "  p50 " << setw(8) << at(0.50) << " us"
+         << "  p99 " << setw(8) << at(0.99) << " us"
+         << "  max " << setw(8) << ns.back() / 1000.0 << " us\n";
+}
+
+// Runs clients against a server, each fetching up to 16 due cards, grading
+// them (about 80% correct) and moving to the next round when nothing is due,
+// then reports latency percentiles per request type.
+int runLoadTest(const string& address, size_t clients, size_t requestsPerClient) {
+    vector<vector<uint32_t>> dueTimes(clients), gradeTimes(clients), nextTimes(clients);
+    atomic<size_t> failures{0};
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> threads;
+    for (size_t c = 0; c < clients; c++) {
+        threads.emplace_back([&, c] {
+            int fd = connectTo(address);
+            if (fd < 0) {
+                failures++;
+                return;
+            }
+            mt19937 rng(c + 1);
+            string buffer, reply, request;
+            vector<size_t> cards;
+            auto timed = [&](vector<uint32_t>& times) {
+                auto sent = chrono::steady_clock::now();
+                if (!sendAll(fd, request) || !readReply(fd, buffer, reply) ||
+                    reply.compare(0, 2, "OK") != 0) {
+                    return false;
+                }
+                times.push_back(chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - sent).count());
+                return true;
+            };
+
+            size_t done = 0;
+            while (done < requestsPerClient) {
+                request = "DUE 16\n";
+                if (!timed(dueTimes[c])) break;
+                done++;
+                istringstream fields(reply.substr(3));
+                size_t count, card;
+                fields >> count;
+                cards.clear();
+                while (fields >> card) cards.push_back(card);
+                if (count == 0) {
+                    request = "NEXT\n";
+                    if (!timed(nextTimes[c])) break;
+                    done++;
+                    continue;
+                }
+                for (size_t i = 0; i < cards.size() && done < requestsPerClient; i++) {
+                    request = (rng() % 5 ? "CORRECT " : "INCORRECT ") +
+                              to_string(cards[i]) + "\n";
+                    if (!timed(gradeTimes[c])) break;
+                    done++;
+                }
+            }
+            if (done < requestsPerClient) failures++;
+            sendAll(fd, "QUIT\n");
+            ::close(fd);
+        });
+    }
+    for (thread& t : threads) t.join();
+    double ms = elapsedMs(start);
+
+    vector<uint32_t> due, grade, next;
+    for (size_t c = 0; c < clients; c++) {
+        due.insert(due.end(), dueTimes[c].begin(), dueTimes[c].end());
+        grade.insert(grade.end(), gradeTimes[c].begin(), gradeTimes[c].end());
+        next.insert(next.end(), nextTimes[c].begin(), nextTimes[c].end());
+    }
+    size_t total = due.size() + grade.size() + next.size();
+    cout << clients << " clients, " << total << " requests in " << fixed
+         << setprecision(1) << ms << " ms (" << setprecision(0)
+         << total / max(ms / 1000, 1e-9) << " requests/s)\n";
+    printLatencies("DUE", due);
+    printLatencies("GRADE", grade);
+    printLatencies("NEXT", next);
+    if (failures > 0) {
+        cerr << failures << " clients failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+// One learner's progress through a deck whose cards are shared with other
+// learners. The learner owns only its progress rows, 16 bytes per card; due
+// cards are found by scanning the due-round column rather than keeping a
+// per-learner due index.
+class LearnerProgress {
+private:
+    const CardTextStore& content;
+    ProgressTable progress;
+    int currentRound = 0;
+    string path;
+    // Set when a rejected progress file could not be moved aside, so save
+    // leaves it alone.
+    bool keepSaved = false;
+
+    // Cards added to the deck after this progress was saved start fresh.
+    void coverContent() {
+        progress.reserve(content.size());
+        while (progress.size() < content.size()) progress.add(0, 0, 0, 0);
+    }
 
-            int choice;
-            cin >> choice;
-            clearInput();
+public:
+    LearnerProgress(const CardTextStore& content, string path)
+        : content(content), path(move(path)) {
+        coverContent();
+    }
 
-            switch (choice) {
-                case 1: createCard(); break;
-                case 2: sessionManager.runSession(deck); break;
-                case 3: showStatistics(); break;
-                case 4: showHeatmap(); break;
-                case 5: resetData(); break;
-                case 6: return;
-                default: cout << "Invalid choice!\n";
+    // Reads the saved progress if it was written for this deck's cards.
+    // textHashFor(n) must return the hash of the first n cards' text. A file
+    // written for other cards is renamed to <path>.rejected, so the fresh
+    // progress saved in its place does not destroy it.
+    template <typename HashFn>
+    bool load(HashFn textHashFor) {
+        MappedFile map;
+        ProgressFileHeader header = {};
+        if (!map.open(path)) return false;
+        if (map.size() >= sizeof(header)) memcpy(&header, map.begin(), sizeof(header));
+        if (map.size() < sizeof(header) ||
+            memcmp(header.magic, PROGRESS_MAGIC, sizeof(PROGRESS_MAGIC)) != 0 ||
+            header.version != PROGRESS_VERSION || header.cardCount > content.size() ||
+            map.size() != sizeof(header) + header.cardCount * 4 * sizeof(int32_t) ||
+            header.contentHash != textHashFor(header.cardCount)) {
+            string aside = path + ".rejected";
+            if (rename(path.c_str(), aside.c_str()) == 0) {
+                cerr << "Progress file " << path
+                     << " was written for other cards; moved to " << aside << "\n";
+            } else {
+                cerr << "Progress file " << path
+                     << " was written for other cards; it will not be saved over\n";
+                keepSaved = true;
+            }
+            return false;
+        }
+        progress.readArrays(map.begin() + sizeof(header), header.cardCount);
+        currentRound = header.currentRound;
+        coverContent();
+        return true;
+    }
+
+    bool save(uint64_t contentHash) const {
+        if (keepSaved) {
+            cerr << "Not saving over " << path
+                 << ", which holds progress for other cards\n";
+            return false;
+        }
+        ProgressFileHeader header = {};
+        memcpy(header.magic, PROGRESS_MAGIC, sizeof(PROGRESS_MAGIC));
+        header.version = PROGRESS_VERSION;
+        header.currentRound = currentRound;
+        header.cardCount = progress.size();
+        header.contentHash = contentHash;
+
+        string tmp = path + ".tmp";
+        {
+            ofstream file(tmp, ios::binary);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            progress.writeArrays(file);
+            if (!file.flush()) {
+                cerr << "Error saving to " << path << "\n";
+                return false;
+            }
+        }
+        if (!commitFile(tmp, path)) {
+            cerr << "Error saving to " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    size_t getCardCount() const { return progress.size(); }
+    CardRecord getRecord(size_t index) const {
+        return CardRecord(content, progress, index);
+    }
+    const ProgressTable& getProgress() const { return progress; }
+    int getCurrentRound() const { return currentRound; }
+    void nextRound() { currentRound++; }
+
+    vector<size_t> getDueCards() const {
+        vector<size_t> due;
+        for (size_t i = 0; i < progress.size(); i++) {
+            if (progress.getDueRound(i) <= currentRound) due.push_back(i);
+        }
+        return due;
+    }
+
+    void markCorrect(size_t index) { progress.markCorrect(index, currentRound); }
+    void markIncorrect(size_t index) { progress.markIncorrect(index, currentRound); }
+};
+
+// Hosts many learners on one deck: the cards are loaded once and shared, and
+// each learner's progress is kept in <deck>.learners/<name>.progress.
+class Classroom {
+private:
+    Deck deck;
+    string directory;
+    uint64_t contentHash = 0;
+    map<string, unique_ptr<LearnerProgress>> learners;
+
+public:
+    bool open(const string& deckFile) {
+        if (!deck.load(deckFile)) return false;
+        directory = deckFile + ".learners";
+        mkdir(directory.c_str(), 0755);
+        contentHash = deck.textHash(deck.getCardCount());
+        return true;
+    }
+
+    // Returns the named learner, reading its saved progress the first time.
+    LearnerProgress& learner(const string& name) {
+        unique_ptr<LearnerProgress>& entry = learners[name];
+        if (!entry) {
+            entry = make_unique<LearnerProgress>(deck.getContent(),
+                                                 directory + "/" + name + ".progress");
+            entry->load([this](size_t n) {
+                return n == deck.getCardCount() ? contentHash : deck.textHash(n);
+            });
+        }
+        return *entry;
+    }
+
+    bool saveAll() const {
+        bool saved = true;
+        for (const auto& [name, progress] : learners) {
+            saved = progress->save(contentHash) && saved;
+        }
+        return saved;
+    }
+
+    const Deck& getDeck() const { return deck; }
+    size_t getLearnerCount() const { return learners.size(); }
+};
+
+// Reviews a shared deck as learnerCount learners (learner1, learner2, ...)
+// for the given number of rounds, about 80% of answers correct, then saves
+// every learner's progress and reports what each learner costs.
+int runLearners(const string& deckFile, size_t learnerCount, int rounds) {
+    Classroom classroom;
+    if (!classroom.open(deckFile)) return 1;
+    long rssBefore = peakRssKb();
+    auto start = chrono::steady_clock::now();
+
+    mt19937 rng(1);
+    size_t reviews = 0;
+    for (size_t l = 1; l <= learnerCount; l++) {
+        LearnerProgress& learner = classroom.learner("learner" + to_string(l));
+        for (int r = 0; r < rounds; r++) {
+            learner.nextRound();
+            for (size_t card : learner.getDueCards()) {
+                if (rng() % 5) learner.markCorrect(card);
+                else learner.markIncorrect(card);
+                reviews++;
+            }
+        }
+    }
+    if (!classroom.saveAll()) return 1;
+
+    size_t cards = classroom.getDeck().getCardCount();
+    size_t progressBytes = 0;
+    for (size_t l = 1; l <= learnerCount; l++) {
+        progressBytes += fileSize(deckFile + ".learners/learner" + to_string(l) + ".progress");
+    }
+    cout << learnerCount << " learners, " << cards << " shared cards, " << reviews
+         << " reviews in " << fixed << setprecision(1) << elapsedMs(start) << " ms\n";
+    cout << "Progress files: " << progressBytes / 1048576.0 << " MB, "
+         << setprecision(1) << double(progressBytes) / max<size_t>(cards * learnerCount, 1)
+         << " bytes per card per learner\n";
+    cout << "Peak RSS grew by " << (peakRssKb() - rssBefore) / 1024.0 << " MB for "
+         << learnerCount << " learners\n";
+    return 0;
+}
+
+// Writes a text deck with generated cards whose due rounds are spread over
+// the next 64 rounds, so roughly 1/64 of the deck is due each round. Fronts
+// and backs are padded with textLength extra characters.
+void writeSyntheticDeck(const string& filename, size_t cardCount,
+                        size_t textLength = 0) {
+    ofstream file(filename);
+    string padding(textLength, 'x');
+    file << 0 << "\n";
+    for (size_t i = 0; i < cardCount; i++) {
+        file << "q" << i << padding << "|a" << i << padding << "|"
+             << i % (MAX_BOX + 1) << "|"
+             << i % 64 << "|" << i % 17 << "|" << i % 9 << "\n";
+    }
+}
+
+void benchmarkLoad(size_t cardCount) {
+    const string textFile = "bench_deck.txt";
+    const string binaryFile = "bench_deck.bin";
+    writeSyntheticDeck(textFile, cardCount);
+    convertDeck(textFile, binaryFile);
+
+    for (const string& file : {textFile, binaryFile}) {
+        Deck loaded;
+        auto start = chrono::steady_clock::now();
+        loaded.load(file);
+        cout << file << ": " << fixed << setprecision(1) << elapsedMs(start)
+             << " ms (" << loaded.getCardCount() << " cards)\n";
+    }
+
+    remove(textFile.c_str());
+    remove(binaryFile.c_str());
+}
+
+// Compares plain and front-coded card text: memory, random and sequential
+// reads, and the size and load time of .bin and .fcz files.
+void benchmarkCompression(size_t cardCount, size_t textLength) {
+    const string textFile = "bench_deck.txt";
+    const string binaryFile = "bench_deck.bin";
+    const string compressedFile = "bench_deck.fcz";
+    writeSyntheticDeck(textFile, cardCount, textLength);
+
+    Xoshiro256 rng(1);
+    vector<size_t> order(1000000);
+    for (size_t& card : order) card = rng.below(cardCount);
+
+    for (bool compress : {false, true}) {
+        Deck deck;
+        deck.setCompressText(compress);
+        {
+            QuietOutput quiet;
+            deck.load(textFile);
+        }
+        volatile size_t sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t card : order) sink += deck.getRecord(card).getBack().size();
+        double randomNs = elapsedMs(start) * 1e6 / order.size();
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < deck.getCardCount(); i++) {
+            sink += deck.getRecord(i).getFront().size();
+        }
+        double scanNs = elapsedMs(start) * 1e6 / deck.getCardCount();
+        cout << (compress ? "front-coded" : "plain      ") << " text: " << fixed
+             << setprecision(1) << deck.textMemoryBytes() / 1048576.0 << " MB, random read "
+             << randomNs << " ns, sequential read " << scanNs << " ns\n";
+        if (compress) {
+            QuietOutput quiet;
+            deck.save(compressedFile);
+        }
+    }
+    convertDeck(textFile, binaryFile);
+
+    for (const string& file : {binaryFile, compressedFile}) {
+        Deck loaded;
+        auto start = chrono::steady_clock::now();
+        {
+            QuietOutput quiet;
+            loaded.load(file);
+        }
+        cout << file << ": " << fixed << setprecision(1) << fileSize(file) / 1048576.0
+             << " MB, loaded in " << elapsedMs(start) << " ms\n";
+    }
+
+    remove(textFile.c_str());
+    remove(binaryFile.c_str());
+    remove(compressedFile.c_str());
+}
+
+void benchmarkDue(size_t cardCount) {
+    const string textFile = "bench_deck.txt";
+    writeSyntheticDeck(textFile, cardCount);
+    Deck deck;
+    deck.load(textFile);
+    remove(textFile.c_str());
+
+    const int rounds = 16;
+    size_t scanned = 0;
+    auto start = chrono::steady_clock::now();
+    const ProgressTable& progress = deck.getProgress();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < progress.size(); i++) {
+            if (progress.getDueRound(i) <= r) scanned++;
+        }
+    }
+    double scanMs = elapsedMs(start) / rounds;
+
+    size_t indexed = 0;
+    Xoshiro256 rng(1);
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        vector<size_t> due = deck.getDueCards(rng);
+        indexed += due.size();
+        for (size_t i = 0; i < due.size() && i < 1000; i++) {
+            deck.markCorrect(due[i]);
+        }
+        deck.nextRound();
+    }
+    double indexMs = elapsedMs(start) / rounds;
+
+    cout << cardCount << " cards: linear scan " << fixed << setprecision(2)
+         << scanMs << " ms/round (" << scanned / rounds << " due), index "
+         << indexMs << " ms/round (" << indexed / rounds << " due)\n";
+}
+
+// Compares the timing wheel with a DueIndex keyed by minute on cards due
+// over the next 30 days: building, regrading, "due now" while the clock
+// advances a minute at a time through a day, and "due within 24 hours".
+void benchmarkWheel(size_t cardCount) {
+    const int start = wallClockMinute();
+    const int days = 30;
+    Xoshiro256 rng(1);
+    vector<int> dues(cardCount);
+    for (int& due : dues) due = start + int(rng.below(days * MINUTES_PER_DAY));
+
+    auto report = [](const char* name, double ms, size_t ops, size_t result) {
+        cout << "  " << left << setw(22) << name << right << fixed << setprecision(1)
+             << ms * 1e6 / ops << " ns/op  (" << result << ")\n";
+    };
+
+    for (int wheel = 0; wheel < 2; wheel++) {
+        cout << (wheel ? "Timing wheel" : "Minute-keyed due index") << ", " << cardCount
+             << " cards:\n";
+        TimingWheel timing;
+        DueIndex index;
+        timing.clear(start);
+        auto t = chrono::steady_clock::now();
+        for (size_t i = 0; i < cardCount; i++) {
+            if (wheel) timing.insert(i, dues[i]);
+            else index.insert(i, dues[i]);
+        }
+        report("insert", elapsedMs(t), cardCount, cardCount);
+
+        const size_t moves = min<size_t>(cardCount, 1000000);
+        t = chrono::steady_clock::now();
+        for (size_t i = 0; i < moves; i++) {
+            int due = start + int(rng.below(days * MINUTES_PER_DAY));
+            if (wheel) timing.move(i, due);
+            else index.move(i, dues[i], due);
+            dues[i] = due;
+        }
+        report("regrade", elapsedMs(t), moves, moves);
+
+        size_t due = 0;
+        t = chrono::steady_clock::now();
+        for (int minute = start; minute < start + MINUTES_PER_DAY; minute++) {
+            if (wheel) {
+                timing.advance(minute);
+                due = timing.countDue();
+            } else {
+                due = index.countDue(minute);
+            }
+        }
+        report("due now (per minute)", elapsedMs(t), MINUTES_PER_DAY, due);
+
+        const int queries = 1000;
+        int now = start + MINUTES_PER_DAY;
+        size_t soon = 0;
+        t = chrono::steady_clock::now();
+        for (int q = 0; q < queries; q++) {
+            soon = wheel ? timing.countDueBy(now + MINUTES_PER_DAY)
+                         : index.countDue(now + MINUTES_PER_DAY);
+        }
+        report("due within 24 hours", elapsedMs(t), queries, soon);
+        if (wheel) {
+            cout << "  " << fixed << setprecision(1)
+                 << double(timing.memoryBytes()) / cardCount << " bytes/card\n";
+        }
+    }
+}
+
+// Measures text loader throughput on a generated deck of about
+// sizeMB megabytes, single-stream versus chunked parallel parsing.
+void benchmarkParse(size_t sizeMB) {
+    const string textFile = "bench_deck.txt";
+    const size_t textLength = 40;
+    const size_t bytesPerCard = 2 * textLength + 30;
+    writeSyntheticDeck(textFile, sizeMB * 1000000 / bytesPerCard, textLength);
+
+    struct stat st;
+    stat(textFile.c_str(), &st);
+    double megabytes = st.st_size / 1e6;
+
+    for (int parallel = 0; parallel < 2; parallel++) {
+        Deck deck;
+        auto start = chrono::steady_clock::now();
+        if (parallel) deck.loadTextParallel(textFile);
+        else deck.loadTextStream(textFile);
+        double ms = elapsedMs(start);
+        cout << (parallel ? "chunked parallel (" : "stream (")
+             << (parallel ? thread::hardware_concurrency() : 1) << " threads): "
+             << fixed << setprecision(1) << ms << " ms, "
+             << megabytes / (ms / 1000) << " MB/s\n";
+    }
+    remove(textFile.c_str());
+}
+
+// Mirrors the old array-of-structs CardRecord layout for comparison.
+struct LegacyCardRecord {
+    FlashCard card;
+    int box = 0;
+    int dueRound = 0;
+    int timesReviewed = 0;
+    int timesCorrect = 0;
+};
+
+// Times the showStatistics, showHeatmap and due-card scans over the old
+// record layout and over the ProgressTable columns.
+void benchmarkScan(size_t cardCount) {
+    const string textFile = "bench_deck.txt";
+    writeSyntheticDeck(textFile, cardCount);
+    Deck deck;
+    deck.load(textFile);
+    remove(textFile.c_str());
+
+    const ProgressTable& progress = deck.getProgress();
+    vector<LegacyCardRecord> legacy(cardCount);
+    for (size_t i = 0; i < cardCount; i++) {
+        CardRecord cr = deck.getRecord(i);
+        legacy[i].card = FlashCard(string(cr.getFront()), string(cr.getBack()));
+        legacy[i].box = cr.getBox();
+        legacy[i].dueRound = cr.getDueRound();
+        legacy[i].timesReviewed = cr.getTimesReviewed();
+        legacy[i].timesCorrect = cr.getTimesCorrect();
+    }
+
+    const int passes = 10;
+    volatile long long sink = 0;
+    auto report = [&](const string& name, double beforeMs, double afterMs) {
+        cout << name << ": before " << fixed << setprecision(2)
+             << beforeMs / passes << " ms, after " << afterMs / passes << " ms\n";
+    };
+
+    auto start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        long long reviews = 0, correct = 0;
+        int boxCounts[MAX_BOX + 1] = {};
+        for (const auto& cr : legacy) {
+            reviews += cr.timesReviewed;
+            correct += cr.timesCorrect;
+            boxCounts[cr.box]++;
+        }
+        sink += reviews + correct + boxCounts[0];
+    }
+    double before = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        long long reviews = 0, correct = 0;
+        int boxCounts[MAX_BOX + 1] = {};
+        for (size_t i = 0; i < progress.size(); i++) {
+            reviews += progress.getTimesReviewed(i);
+            correct += progress.getTimesCorrect(i);
+            boxCounts[progress.getBox(i)]++;
+        }
+        sink += reviews + correct + boxCounts[0];
+    }
+    report("showStatistics totals", before, elapsedMs(start));
+
+    start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        int boxCounts[MAX_BOX + 1] = {};
+        for (const auto& cr : legacy) boxCounts[cr.box]++;
+        sink += boxCounts[MAX_BOX];
+    }
+    before = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        int boxCounts[MAX_BOX + 1] = {};
+        for (size_t i = 0; i < progress.size(); i++) boxCounts[progress.getBox(i)]++;
+        sink += boxCounts[MAX_BOX];
+    }
+    report("showHeatmap counts", before, elapsedMs(start));
+
+    start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        for (const auto& cr : legacy) sink += cr.dueRound <= p;
+    }
+    before = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        for (size_t i = 0; i < progress.size(); i++) sink += progress.getDueRound(i) <= p;
+    }
+    report("getDueCards scan", before, elapsedMs(start));
+}
+
+// The normalization used before it understood UTF-8: ASCII letters and
+// digits lowercased, every other byte dropped.
+size_t legacyNormalizeInto(string_view str, char* out) {
+    size_t n = 0;
+    for (unsigned char c : str) {
+        if (isalnum(c)) out[n++] = tolower(c);
+    }
+    return n;
+}
+
+// Times AnswerChecker::normalizeInto against the old ASCII-only version on
+// about sizeMB megabytes of generated answers per script, and counts how
+// many distinct answers each keeps apart.
+void benchmarkNormalize(size_t sizeMB) {
+    const pair<const char*, const char*> corpora[] = {
+        {"ASCII", "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"},
+        {"Latin accented", "abcdeghilmnorstuàáâäçèéêëìíîïñòóôöùúûüÿßæœÀÉÈÇÖÜŁłŒØøčšžő"},
+        {"Cyrillic", "абвгдежзийклмнопрстуфхцчшщъыьэюяёАБВГДЕЖЗИЙКЛМНОПРСТЁЯ"},
+        {"Greek", "αβγδεζηθικλμνξοπρστυφχψωάέήίόύώϊΑΒΓΔΕΖΗΘΛΠΣΦΨΩ"},
+        {"CJK", "日本語中文漢字学生先生大小山川水火木金土年月時間人口"},
+        {"mixed", "abcxyzABéèüñßЖжяЯёλΛάω日本語学生"}};
+
+    mt19937 random(7);
+    for (const auto& corpus : corpora) {
+        vector<string> letters;
+        for (const char* c = corpus.second; *c;) {
+            const char* end = c + 1;
+            while ((*end & 0xC0) == 0x80) end++;
+            letters.emplace_back(c, end);
+            c = end;
+        }
+
+        vector<string> answers;
+        size_t bytes = 0;
+        while (bytes < sizeMB * 1000000) {
+            string answer;
+            int words = 1 + random() % 4;
+            for (int w = 0; w < words; w++) {
+                if (w > 0) answer += random() % 4 ? " " : ", ";
+                int length = 2 + random() % 6;
+                for (int k = 0; k < length; k++) answer += letters[random() % letters.size()];
+            }
+            bytes += answer.size();
+            answers.push_back(move(answer));
+        }
+
+        string out;
+        for (int legacy = 1; legacy >= 0; legacy--) {
+            volatile size_t sink = 0;
+            vector<string> keys;
+            auto start = chrono::steady_clock::now();
+            for (const string& answer : answers) {
+                out.resize(answer.size());
+                sink += legacy ? legacyNormalizeInto(answer, &out[0])
+                               : AnswerChecker::normalizeInto(answer, &out[0]);
+            }
+            double ms = elapsedMs(start);
+            for (size_t i = 0; i < answers.size() && i < 100000; i++) {
+                out.resize(answers[i].size());
+                size_t n = legacy ? legacyNormalizeInto(answers[i], &out[0])
+                                  : AnswerChecker::normalizeInto(answers[i], &out[0]);
+                keys.emplace_back(out, 0, n);
+            }
+            sort(keys.begin(), keys.end());
+            keys.erase(unique(keys.begin(), keys.end()), keys.end());
+            cout << corpus.first << (legacy ? " (old): " : " (new): ") << fixed
+                 << setprecision(1) << bytes / 1e6 / (ms / 1000) << " MB/s, "
+                 << keys.size() << " distinct keys of "
+                 << min<size_t>(answers.size(), 100000) << " answers\n";
+        }
+    }
+}
+
+// Counts heap allocations while loading and iterating a deck in each format.
+void benchmarkAllocations(size_t cardCount) {
+#ifdef COUNT_ALLOCATIONS
+    const string textFile = "bench_deck.txt";
+    const string binaryFile = "bench_deck.bin";
+    writeSyntheticDeck(textFile, cardCount);
+    convertDeck(textFile, binaryFile);
+
+    for (const string& file : {textFile, binaryFile}) {
+        Deck deck;
+        size_t before = allocationCount;
+        deck.load(file);
+        size_t loadAllocations = allocationCount - before;
+
+        before = allocationCount;
+        size_t textBytes = 0;
+        for (size_t i = 0; i < deck.getCardCount(); i++) {
+            CardRecord cr = deck.getRecord(i);
+            textBytes += cr.getFront().size() + cr.getBack().size();
+        }
+        size_t iterateAllocations = allocationCount - before;
+
+        cout << file << ": " << loadAllocations << " allocations to load, "
+             << iterateAllocations << " to iterate " << textBytes
+             << " bytes of text\n";
+    }
+
+    remove(textFile.c_str());
+    remove(binaryFile.c_str());
+#else
+    (void)cardCount;
+    cout << "Rebuild with -DCOUNT_ALLOCATIONS to count allocations\n";
+#endif
+}
+
+// Runs every Deck hot path over generated decks of increasing size and
+// prints ns/op, throughput and the process's peak RSS so far.
+class BenchmarkSuite {
+private:
+    size_t textLength;
+
+    void report(size_t cards, const string& name, size_t ops, double ms,
+                double bytes = 0) {
+        double ns = ms * 1e6 / max<size_t>(ops, 1);
+        cout << setw(9) << cards << "  " << left << setw(22) << name << right
+             << fixed << setprecision(1) << setw(10) << ns << " ns/op  ";
+        if (bytes > 0) {
+            cout << setw(9) << bytes / 1e6 / (ms / 1000) << " MB/s    ";
+        } else {
+            cout << setw(9) << ops / (ms / 1000) / 1e6 << " Mops/s  ";
+        }
+        cout << setw(8) << peakRssKb() / 1024 << " MB peak RSS\n";
+    }
+
+    void runSize(size_t cardCount) {
+        const string textFile = "bench_deck.txt";
+        const string binaryFile = "bench_deck.bin";
+        writeSyntheticDeck(textFile, cardCount, textLength);
+
+        Deck deck;
+        auto start = chrono::steady_clock::now();
+        {
+            QuietOutput quiet;
+            deck.load(textFile);
+        }
+        report(cardCount, "load text", cardCount, elapsedMs(start), fileSize(textFile));
+
+        start = chrono::steady_clock::now();
+        {
+            QuietOutput quiet;
+            deck.save(textFile);
+        }
+        report(cardCount, "save text", cardCount, elapsedMs(start), fileSize(textFile));
+
+        start = chrono::steady_clock::now();
+        {
+            QuietOutput quiet;
+            deck.save(binaryFile);
+        }
+        report(cardCount, "save binary", cardCount, elapsedMs(start), fileSize(binaryFile));
+
+        {
+            Deck binary;
+            start = chrono::steady_clock::now();
+            {
+                QuietOutput quiet;
+                binary.load(binaryFile);
+            }
+            report(cardCount, "load binary", cardCount, elapsedMs(start),
+                   fileSize(binaryFile));
+        }
+        remove(textFile.c_str());
+        remove(binaryFile.c_str());
+
+        volatile long long sink = 0;
+        const int passes = 5;
+        const size_t summaries = 1000000;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < summaries; i++) {
+            const DeckStats& stats = deck.getStats();
+            sink += stats.totalReviews + stats.totalCorrect;
+        }
+        report(cardCount, "statistics totals", summaries, elapsedMs(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < summaries; i++) {
+            sink += deck.getStats().boxCounts[i % (MAX_BOX + 1)];
+        }
+        report(cardCount, "heatmap counts", summaries, elapsedMs(start));
+
+        Xoshiro256 rng(1);
+        start = chrono::steady_clock::now();
+        size_t dueCards = 0;
+        for (int p = 0; p < passes; p++) dueCards += deck.getDueCards(rng).size();
+        report(cardCount, "getDueCards (per due)", dueCards, elapsedMs(start));
+
+        start = chrono::steady_clock::now();
+        size_t topCards = 0;
+        for (int p = 0; p < passes; p++) {
+            topCards += deck.getDueCards(rng, SESSION_CARDS).size();
+        }
+        report(cardCount, "top 20 due (per card)", topCards, elapsedMs(start));
+
+        size_t grades = min<size_t>(cardCount, 1000000);
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < grades; i++) deck.markCorrect(i);
+        report(cardCount, "markCorrect", grades, elapsedMs(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < grades; i++) deck.markIncorrect(i);
+        report(cardCount, "markIncorrect", grades, elapsedMs(start));
+
+        size_t answers = min<size_t>(cardCount, 200000);
+        string typed;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < answers; i++) {
+            CardRecord cr = deck.getRecord(i);
+            sink += deck.checkAnswer(cr.getBack(), cr.getBack());
+        }
+        report(cardCount, "checkAnswer exact", answers, elapsedMs(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < answers; i++) {
+            string_view back = deck.getRecord(i).getBack();
+            typed.assign(back.data(), back.size());
+            typed.back() = '#';
+            sink += deck.gradeTypedAnswer(typed, back).accepted;
+        }
+        report(cardCount, "checkAnswer typo", answers, elapsedMs(start));
+    }
+
+public:
+    explicit BenchmarkSuite(size_t textLength) : textLength(textLength) {}
+
+    void run(size_t maxCards) {
+        cout << setw(9) << "cards" << "  " << left << setw(22) << "operation"
+             << right << setw(16) << "time" << setw(17) << "throughput"
+             << setw(21) << "memory\n";
+        for (size_t cards = 1000; cards <= maxCards; cards *= 10) {
+            runSize(cards);
+        }
+    }
+};
+
+// Regression checks run by --self-test against files in a scratch
+// directory, for bugs that have lost decks before. Prints one PASS or FAIL
+// line per check and returns the number that failed.
+class SelfTest {
+private:
+    string dir;
+    int failures = 0;
+
+    string path(const string& name) const { return dir + "/" + name; }
+
+    static string readFile(const string& filename) {
+        ifstream file(filename, ios::binary);
+        return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+
+    static void writeFile(const string& filename, const string& contents) {
+        ofstream(filename, ios::binary) << contents;
+    }
+
+    void check(const string& name, bool passed) {
+        cout << (passed ? "PASS " : "FAIL ") << name << "\n";
+        if (!passed) failures++;
+    }
+
+    // The deck as text, for comparing decks saved in any format.
+    string deckText(const string& filename) {
+        string text = path("compare.txt");
+        {
+            QuietOutput quiet;
+            if (convertDeck(filename, text) != 0) return "";
+        }
+        return readFile(text);
+    }
+
+    // Converting and deduplicating a deck onto its own path must not
+    // truncate the file its text is still mapped from.
+    void checkSaveInPlace(const string& format) {
+        const string deck = "0\na|b|1|2|3|2\nc|d|0|0|0|0\na|b|0|0|1|1\n";
+        string source = path("source.txt"), target = path("deck." + format);
+        writeFile(source, deck);
+        int converted, convertedInPlace, deduplicated;
+        {
+            QuietOutput quiet;
+            converted = convertDeck(source, target);
+            convertedInPlace = convertDeck(target, target);
+        }
+        check("convert ." + format + " onto itself",
+              converted == 0 && convertedInPlace == 0 && deckText(target) == deck);
+        {
+            QuietOutput quiet;
+            deduplicated = dedupDeck(target, target, false);
+        }
+        check("dedup ." + format + " onto itself",
+              deduplicated == 0 && deckText(target) == "0\na|b|0|0|4|3\nc|d|0|0|0|0\n");
+    }
+
+    // Resetting from the menu must drop the wall-clock schedule along with
+    // the cards, so stale due times are never applied to new cards.
+    void checkReset() {
+        string deck = path("reset.txt");
+        writeFile(deck, "0\na|b|1|2|3|2\n");
+        int scheduled;
+        {
+            QuietOutput quiet;
+            scheduled = scheduleByWallClock(deck);
+        }
+        bool hadTimes = fileSize(deck + ".times") > 0;
+        istringstream input("5\nyes\n1\nq\na\n8\n");
+        streambuf* savedInput = cin.rdbuf(input.rdbuf());
+        {
+            QuietOutput quiet;
+            FlashCardApp app(deck);
+            app.run();
+        }
+        cin.rdbuf(savedInput);
+        struct stat st;
+        check("reset removes wall-clock due times",
+              scheduled == 0 && hadTimes && stat((deck + ".times").c_str(), &st) != 0);
+    }
+
+    void removeDirectory() {
+        if (DIR* listing = opendir(dir.c_str())) {
+            while (dirent* entry = readdir(listing)) {
+                string name = entry->d_name;
+                if (name != "." && name != "..") remove(path(name).c_str());
             }
+            closedir(listing);
         }
+        rmdir(dir.c_str());
+    }
+
+public:
+    int run() {
+        const char* tmp = getenv("TMPDIR");
+        string pattern = string(tmp && *tmp ? tmp : "/tmp") + "/flashcard3-test-XXXXXX";
+        if (!mkdtemp(&pattern[0])) {
+            cerr << "Cannot create a directory from " << pattern << "\n";
+            return 1;
+        }
+        dir = pattern;
+        for (const char* format : {"txt", "bin", "fcz"}) checkSaveInPlace(format);
+        checkReset();
+        removeDirectory();
+        cout << (failures ? to_string(failures) + " checks failed\n" : "All checks passed\n");
+        return failures;
     }
 };
 
-int main() {
+void printUsage() {
+    cerr << "Usage: flashcard3 [--metrics] [command]\n"
+         << "With no command, studies spaced_cards.txt interactively. Commands:\n"
+         << "  --dedup <in> <out> [both]          --convert <in> <out>\n"
+         << "  --migrate <in dir> <out dir> [txt|bin|fcz]\n"
+         << "  --import <deck> <file> [csv|tsv]   --wall-clock <deck>\n"
+         << "  --memory <deck> [cache MB]         --paged <deck.bin> [cache MB]\n"
+         << "  --simulate [key=value ...]         --replay <deck> <events>\n"
+         << "  --export <deck> <out> [csv|jsonl]  --grade <deck> <answers>\n"
+         << "  --serve <deck> <port|socket>       --learners <deck> <count> [rounds]\n"
+         << "  --load-test <port|socket> [clients] [requests]\n"
+         << "  --bench [max cards] [text length]  --bench-compress [cards] [text length]\n"
+         << "  --bench-load|--bench-wheel|--bench-due|--bench-scan|--bench-alloc [cards]\n"
+         << "  --bench-parse|--bench-normalize [MB]   --self-test\n";
+}
+
+// Runs the command in args, or the app if there is none. A malformed
+// command prints the usage and fails rather than starting the app.
+int runCommand(const vector<string>& args) {
+    // Numeric argument i, or fallback if it is absent; a malformed one sets
+    // badNumber and the command falls through to the usage message.
+    bool badNumber = false;
+    auto count = [&](size_t i, size_t fallback) {
+        size_t value = fallback;
+        if (i < args.size() && !parseCount(args[i], value)) badNumber = true;
+        return value;
+    };
+
+    if ((args.size() == 3 || args.size() == 4) && args[0] == "--dedup") {
+        if (args.size() == 4 && args[3] != "both") {
+            cerr << "Usage: --dedup <in> <out> [both]\n";
+            return 1;
+        }
+        return dedupDeck(args[1], args[2], args.size() == 4);
+    }
+    if (args.size() == 3 && args[0] == "--convert") {
+        return convertDeck(args[1], args[2]);
+    }
+    if ((args.size() == 3 || args.size() == 4) && args[0] == "--migrate") {
+        string format = args.size() == 4 ? args[3] : "txt";
+        if (format != "txt" && format != "bin" && format != "fcz") {
+            cerr << "Usage: --migrate <input dir> <output dir> [txt|bin|fcz]\n";
+            return 1;
+        }
+        return migrateDecks(args[1], args[2], format);
+    }
+    if (args.size() == 2 && args[0] == "--wall-clock") {
+        return scheduleByWallClock(args[1]);
+    }
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "--memory") {
+        size_t cacheMB = count(2, 0);
+        if (!badNumber) return reportMemory(args[1], cacheMB);
+    }
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "--paged") {
+        size_t cacheMB = count(2, DEFAULT_TEXT_CACHE_MB);
+        if (!badNumber) {
+            FlashCardApp app(args[1], cacheMB << 20);
+            app.run();
+            return 0;
+        }
+    }
+    if ((args.size() == 3 || args.size() == 4) && args[0] == "--import") {
+        return importCardFile(args[1], args[2], args.size() == 4 ? args[3] : "");
+    }
+    if (!args.empty() && args[0] == "--simulate") {
+        SimulationConfig config;
+        if (!parseSimulationConfig(args, config)) {
+            cerr << "Usage: --simulate [learners=N] [cards=N] [rounds=N] [new=N]\n"
+                 << "       [first=P] [stability=S] [growth=G] [intervals=a,b,...]\n"
+                 << "       [threads=N] [seed=N]\n";
+            return 1;
+        }
+        LeitnerSimulator(config).run();
+        return 0;
+    }
+    if (args.size() == 3 && args[0] == "--replay") {
+        return replayGrades(args[1], args[2]);
+    }
+    if ((args.size() == 3 || args.size() == 4) && args[0] == "--export") {
+        return exportStats(args[1], args[2], args.size() == 4 ? args[3] : "");
+    }
+    if (args.size() == 3 && args[0] == "--serve") {
+        return serveDeck(args[1], args[2]);
+    }
+    if (args.size() >= 2 && args.size() <= 4 && args[0] == "--load-test") {
+        size_t clients = count(2, 8), requests = count(3, 10000);
+        if (!badNumber) return runLoadTest(args[1], clients, requests);
+    }
+    if (args.size() >= 3 && args.size() <= 4 && args[0] == "--learners") {
+        size_t learners = count(2, 0), rounds = count(3, 30);
+        if (!badNumber && rounds <= size_t(numeric_limits<int>::max())) {
+            return runLearners(args[1], learners, rounds);
+        }
+    }
+    if (args.size() == 3 && args[0] == "--grade") {
+        return gradeAnswers(args[1], args[2]);
+    }
+    if (args.size() <= 3 && !args.empty() && args[0] == "--bench") {
+        size_t maxCards = count(1, 10000000), textLength = count(2, 16);
+        if (!badNumber) {
+            BenchmarkSuite(textLength).run(maxCards);
+            return 0;
+        }
+    }
+    if (args.size() <= 3 && !args.empty() && args[0] == "--bench-compress") {
+        size_t cardCount = count(1, 1000000), textLength = count(2, 16);
+        if (!badNumber) {
+            benchmarkCompression(cardCount, textLength);
+            return 0;
+        }
+    }
+    if (args.size() == 2 && args[0] == "--bench-due") {
+        size_t cardCount = count(1, 0);
+        if (!badNumber) {
+            benchmarkDue(cardCount);
+            return 0;
+        }
+    }
+    if (args.size() == 1 && args[0] == "--bench-due") {
+        benchmarkDue(1000000);
+        benchmarkDue(10000000);
+        return 0;
+    }
+    static const struct {
+        const char* name;
+        void (*run)(size_t);
+        size_t fallback;
+    } sizedBenchmarks[] = {
+        {"--bench-load", benchmarkLoad, 1000000},
+        {"--bench-wheel", benchmarkWheel, 10000000},
+        {"--bench-parse", benchmarkParse, 1024},
+        {"--bench-normalize", benchmarkNormalize, 64},
+        {"--bench-alloc", benchmarkAllocations, 1000000},
+        {"--bench-scan", benchmarkScan, 1000000},
+    };
+    for (const auto& benchmark : sizedBenchmarks) {
+        if (args.size() > 2 || args.empty() || args[0] != benchmark.name) continue;
+        size_t size = count(1, benchmark.fallback);
+        if (badNumber) break;
+        benchmark.run(size);
+        return 0;
+    }
+
+    if (args.size() == 1 && args[0] == "--self-test") {
+        return SelfTest().run() == 0 ? 0 : 1;
+    }
+
+    if (!args.empty()) {
+        printUsage();
+        return 1;
+    }
     FlashCardApp app;
     app.run();
     return 0;
 }
+
+// "--metrics" in front of any command (or alone, for the app) dumps the
+// collected metrics to stderr once it finishes.
+int main(int argc, char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    bool metrics = !args.empty() && args[0] == "--metrics";
+    if (metrics) args.erase(args.begin());
+    int status = runCommand(args);
+    if (metrics) dumpMetrics(cerr);
+    return status;
+}